@@ -1,10 +1,15 @@
 #ifndef SURGE_MODULE_FLAPPY_BIRD_HPP
 #define SURGE_MODULE_FLAPPY_BIRD_HPP
 
+#include "sc_glm_includes.hpp"
 #include "sc_opengl/atoms/pv_ubo.hpp"
 #include "sc_opengl/atoms/sprite_database.hpp"
 #include "sc_opengl/atoms/texture.hpp"
 #include "sc_window.hpp"
+#include "telemetry.hpp"
+
+#include <random>
+#include <type_traits>
 
 #if defined(SURGE_COMPILER_Clang)                                                                  \
     || defined(SURGE_COMPILER_GCC) && COMPILING_SURGE_MODULE_FLAPPY_BIRD
@@ -26,14 +31,283 @@ using pvubo_t = surge::gl_atom::pv_ubo::buffer;
 using tdb_t = surge::gl_atom::texture::database;
 using sdb_t = surge::gl_atom::sprite_database::database;
 
+// Sprite buffers the database rotates between, so that a frame never writes one the GPU still reads
+inline constexpr surge::usize sprite_buffer_redundancy{3};
+
+namespace resources {
+
+enum theme : surge::u32 { classic, night, canary, count };
+
+struct handles {
+  GLuint64 background{0};
+  GLuint64 pipe{0};
+  GLuint64 bird_sheet{0};
+  GLuint64 base{0};
+  GLuint64 instructions_1{0};
+  GLuint64 instructions_2{0};
+  GLuint64 game_over{0};
+  std::array<GLuint64, 10> numbers{};
+
+  auto operator==(const handles &) const noexcept -> bool = default;
+};
+
+// Decodes streamed images on worker threads and uploads them through a persistently mapped staging
+// buffer, a slice per frame
+struct uploader;
+
+// Only the first frame is loaded into the texture database, everything else is streamed. Theme
+// switches only take effect once every texture of the new theme is resident, so the old theme keeps
+// being drawn in the meantime.
+struct loader {
+  surge::gl_atom::texture::create_info ci{};
+  theme active_theme{theme::classic};
+  theme requested_theme{theme::classic};
+  handles active{};
+  uploader *async{nullptr};
+};
+
+void load_first_frame(tdb_t &tdb, loader &l) noexcept;
+void stream(const tdb_t &tdb, loader &l) noexcept;
+void request_theme(const tdb_t &tdb, loader &l, theme t) noexcept;
+void unload(loader &l) noexcept;
+auto play_ready(const handles &h) noexcept -> bool;
+
+auto theme_to_str(const theme &t) noexcept -> const char *;
+
+} // namespace resources
+
+namespace entities {
+
+// Entities live in fixed slots, ordered back to front. Upper pipes are not stored, they are
+// mirrored from the lower ones.
+enum slot : surge::u32 { base_l, base_r, pipe_0, pipe_1, pipe_2, pipe_3, bird, count };
+
+inline constexpr surge::u32 pipe_count{4};
+
+enum class sprite : surge::u32 { base, pipe, bird };
+
+// Flap animation frames in the bird sheets, as x, y, width, height in texels
+inline const std::array<glm::vec4, 4> bird_frame_views{
+    glm::vec4{1.0f, 1.0f, 34.0f, 24.0f}, glm::vec4{36.0f, 1.0f, 34.0f, 24.0f},
+    glm::vec4{71.0f, 1.0f, 34.0f, 24.0f}, glm::vec4{106.0f, 1.0f, 34.0f, 24.0f}};
+
+// Sprite sizes and positions derived from the window size
+struct layout {
+  glm::vec2 window_dims{0.0f};
+  glm::vec2 bird_sheet_size{0.0f};
+  glm::vec2 base_bbox{0.0f};
+  glm::vec2 bird_bbox{0.0f};
+  glm::vec2 bird_origin{0.0f};
+  glm::vec2 pipe_gaps{0.0f};
+  glm::vec2 pipe_bbox{0.0f};
+  glm::vec2 instructions_1_bbox{0.0f};
+  glm::vec2 instructions_2_bbox{0.0f};
+  glm::vec2 game_over_bbox{0.0f};
+  glm::vec2 numbers_bbox{0.0f};
+  float pipe_y_min{0.0f};
+  float pipe_y_max{0.0f};
+};
+
+// All the mutable state of a game. Update passes iterate the entity arrays linearly. The store is
+// trivially copyable, so a game can be reset, run alongside others or snapshotted with a memcpy.
+struct store {
+  std::array<glm::vec2, slot::count> position{};
+  std::array<glm::vec2, slot::count> velocity{};
+  std::array<glm::vec2, slot::count> bbox{};
+  std::array<float, slot::count> depth{};
+  std::array<sprite, slot::count> sprite_ref{};
+
+  // Pipe slots form a ring, first_pipe is the offset of the leftmost one
+  surge::u32 first_pipe{0};
+
+  // Bird animation
+  surge::u32 flap_frame{0};
+  float flap_elapsed{0.0f};
+
+  // Fixed step accumulators
+  float bird_elapsed{0.0f};
+  float scroll_elapsed{0.0f};
+
+  // Score
+  surge::u64 score{0};
+  int prev_dist_sign{0};
+  surge::u32 collided{0};
+
+  surge::u32 old_button_down{0};
+  std::minstd_rand engine{};
+};
+
+static_assert(std::is_trivially_copyable_v<store>);
+
+auto make_layout(const glm::vec2 &window_dims) noexcept -> layout;
+auto create(const layout &l, surge::u32 seed) noexcept -> store;
+void reset(store &s, const layout &l) noexcept;
+auto random_pipe_y(store &s, const layout &l) noexcept -> float;
+
+// Slot of the i-th pipe counting from the left
+inline auto pipe_slot(const store &s, surge::u32 i) noexcept -> surge::u32 {
+  return slot::pipe_0 + (s.first_pipe + i) % pipe_count;
+}
+
+} // namespace entities
+
+namespace collision {
+
+// Opaque texels of a sprite, one word per row with the top row first. Bit x of a row is set when
+// texel x is opaque, so masks are at most 64 texels wide.
+struct mask {
+  surge::u32 width{0};
+  surge::u32 height{0};
+  surge::vector<surge::u64> rows{};
+};
+
+struct masks {
+  std::array<mask, 4> bird_frames{};
+  std::array<surge::u32, 4> bird_bottom_rows{}; // Lowest opaque row of each frame
+  mask pipe_down{};
+  mask pipe_up{};
+};
+
+auto load_masks() noexcept -> masks;
+
+// Narrow phase between two sprites drawn with the same horizontal texel size. Only worth calling
+// once their bounding boxes are known to overlap.
+auto overlap(const mask &a, const glm::vec2 &a_pos, const glm::vec2 &a_bbox, const mask &b,
+             const glm::vec2 &b_pos, const glm::vec2 &b_bbox) noexcept -> bool;
+
+} // namespace collision
+
+namespace rewind {
+
+// History of a practice run. Every play tick is stored as the words of the store that differ from
+// the last keyframe, so any tick is restored with one keyframe copy and one delta.
+inline constexpr surge::usize store_words{sizeof(entities::store) / sizeof(surge::u32)};
+inline constexpr surge::usize changed_words{(store_words + 63) / 64};
+
+static_assert(sizeof(entities::store) % sizeof(surge::u32) == 0);
+
+// A little over 34 s at 60 Hz
+inline constexpr surge::usize frame_capacity{2048};
+inline constexpr surge::usize key_interval{64};
+inline constexpr surge::usize key_capacity{frame_capacity / key_interval + 1};
+
+// Ticks that drift further than this from their keyframe become keyframes themselves
+inline constexpr surge::usize max_delta_words{32};
+
+struct frame {
+  surge::u64 key{0};
+  float dt{0.0f};
+  surge::u32 word_count{0};
+  std::array<surge::u64, changed_words> changed{};
+  std::array<surge::u32, max_delta_words> words{};
+};
+
+struct history {
+  bool enabled{false};
+
+  std::array<entities::store, key_capacity> keys{};
+  std::array<frame, frame_capacity> frames{};
+  surge::u64 keys_taken{0};
+  surge::u64 frames_taken{0};
+  surge::u64 oldest{0};
+  surge::u64 since_key{0};
+
+  // Playback
+  surge::u64 cursor{0};
+  float remaining{0.0f};
+
+  // Capture cost
+  surge::u64 capture_count{0};
+  double capture_us_total{0.0};
+  double capture_us_max{0.0};
+};
+
+void clear(history &h) noexcept;
+auto empty(const history &h) noexcept -> bool;
+void capture(history &h, const entities::store &s, float dt) noexcept;
+
+// Starts rewinding seconds of play from the newest tick. False if there is nothing to rewind.
+auto begin(history &h, float seconds) noexcept -> bool;
+
+// Moves the cursor one tick back and returns the frame time undone, or 0 at the oldest tick
+auto step_back(history &h) noexcept -> float;
+
+void restore(const history &h, entities::store &s) noexcept;
+
+// Drops the ticks after the cursor so that play continues from it
+void resume(history &h) noexcept;
+
+void log_capture_cost(const history &h) noexcept;
+
+} // namespace rewind
+
+namespace replay {
+
+// Everything that is not deterministic in a run: the pipe RNG seed, the window size the layout is
+// derived from and, per update, the frame time and the input. Textures stream in on wall clock
+// time, so whether play could start on an update is kept as well.
+struct tick {
+  float dt;
+  surge::u32 button_down;
+  surge::u32 theme_presses;
+  surge::u32 textures_ready;
+};
+
+struct recording {
+  surge::u32 seed{0};
+  surge::u32 window_width{0};
+  surge::u32 window_height{0};
+  surge::vector<tick> ticks{};
+};
+
+auto load(const char *path) noexcept -> std::optional<recording>;
+auto save(const char *path, const recording &r) noexcept -> bool;
+
+} // namespace replay
+
+namespace video_export {
+
+// Renders into an offscreen framebuffer and streams the frames to encoder threads. Outputs ending
+// in .rgb are written as a single raw rgb24 video, anything else as a directory of PPM images.
+struct exporter;
+
+// Exported videos run on a fixed clock, whatever the spacing of the replayed ticks
+inline constexpr double frame_rate{60.0};
+
+auto create(window_t w, const char *output) noexcept -> exporter *;
+
+// Advances the output clock by the simulated time of an update. The next frame drawn is written
+// once for every output frame that came due, which may be none.
+void advance(exporter *e, double dt) noexcept;
+
+void begin_frame(exporter *e) noexcept;
+void end_frame(exporter *e) noexcept;
+void destroy(exporter *e) noexcept;
+
+} // namespace video_export
+
 namespace state_machine {
 
 using state_t = surge::u32;
-enum state : surge::u32 { no_state, prepare, play, score, count };
+enum state : surge::u32 { no_state, prepare, play, score, rewinding, count };
+
+// What the sprites of a screen without motion were last built from. They are only rebuilt when one
+// of these changes, once for each buffer of the sprite database so that none of them is left
+// holding the old sprites. Such screens also flag themselves as idle so the frame rate can drop.
+struct scene {
+  state built_state{state::no_state};
+  resources::handles built_textures{};
+  glm::vec2 built_dims{0.0f};
+  surge::u64 built_score{0};
+  surge::usize rebuilds_left{0};
+  bool idle{false};
+};
 
 void state_transition(state &state_a, state &state_b) noexcept;
-void state_update(window_t w, const fpb::tdb_t &tdb, fpb::sdb_t &sdb, const state &state_a,
-                  state &state_b, double dt) noexcept;
+void state_update(window_t w, const resources::handles &textures,
+                  const collision::masks &masks, fpb::sdb_t &sdb, entities::store &game,
+                  rewind::history &history, scene &sc, const state &state_a, state &state_b,
+                  bool button_down, bool textures_ready, double dt) noexcept;
 
 auto state_to_str(const state &s) noexcept -> const char *;
 
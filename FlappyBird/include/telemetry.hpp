@@ -0,0 +1,103 @@
+#ifndef SURGE_MODULE_FLAPPY_BIRD_TELEMETRY_HPP
+#define SURGE_MODULE_FLAPPY_BIRD_TELEMETRY_HPP
+
+// Per tick game state published by the module into a POSIX shared memory ring. This header does not
+// depend on the engine so that external tools can read the stream by linking only the telemetry
+// library.
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+
+namespace fpb::telemetry {
+
+inline constexpr const char *default_name{"/fpb_telemetry"};
+
+inline constexpr std::uint32_t magic{0x46504254}; // FPBT
+inline constexpr std::uint32_t version{2};
+
+inline constexpr std::uint32_t max_pipes{4};
+inline constexpr std::size_t max_state_name{16};
+
+// Must be a power of two
+inline constexpr std::uint64_t ring_capacity{1024};
+
+struct record {
+  std::uint64_t tick;
+  std::uint64_t score;
+  std::array<char, max_state_name> state_name; // Null terminated
+  std::uint32_t collided;
+  float bird_y;
+  float bird_vy;
+  std::uint32_t pipe_count;
+  float dt;
+  float update_us;
+  float draw_us;
+  std::array<float, 2 * max_pipes> pipes; // x, y of each lower pipe
+};
+
+// Each slot is a seqlock. The sequence is odd while the writer is inside the slot and 2 * (i + 1)
+// once record i is complete, which lets readers detect torn or overwritten records.
+struct alignas(64) slot {
+  std::atomic<std::uint64_t> sequence;
+  record data;
+};
+
+struct ring {
+  std::uint32_t magic;
+  std::uint32_t version;
+  std::uint64_t capacity;
+  std::uint64_t record_size;
+  std::atomic<std::int32_t> writer_pid; // Zero once the writer closed the ring
+  alignas(64) std::atomic<std::uint64_t> head;
+  std::array<slot, ring_capacity> slots;
+};
+
+struct writer {
+  ring *shm{nullptr};
+  std::uint64_t next{0};
+  std::uint64_t inode{0};
+};
+
+struct reader {
+  const ring *shm{nullptr};
+  std::uint64_t next{0};
+};
+
+// Fails if another live process is writing to name. A ring left behind by a writer that is gone is
+// replaced.
+auto open_writer(const char *name = default_name) noexcept -> std::optional<writer>;
+
+// Removes name only if it still refers to the ring of w
+void close_writer(writer &w, const char *name = default_name) noexcept;
+
+auto open_reader(const char *name = default_name) noexcept -> std::optional<reader>;
+void close_reader(reader &r) noexcept;
+
+// False once the writer closed the ring or its process is gone. A restarted game writes to a new
+// ring under the same name, so readers have to reopen it to follow.
+auto writer_alive(const reader &r) noexcept -> bool;
+
+// Reads the next record, returning false if there is none yet. When the writer laps the reader, it
+// skips ahead to the oldest record still in the ring and adds the skipped records to lost.
+auto read(reader &r, record &out, std::uint64_t &lost) noexcept -> bool;
+
+// Wait free: the writer never looks at readers, slow readers are overrun instead.
+inline void publish(writer &w, const record &rec) noexcept {
+  const auto i{w.next++};
+  auto &s{w.shm->slots[i & (ring_capacity - 1)]}; // NOLINT
+
+  s.sequence.store(2 * i + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+
+  std::memcpy(&s.data, &rec, sizeof(record));
+
+  s.sequence.store(2 * i + 2, std::memory_order_release);
+  w.shm->head.store(i + 1, std::memory_order_release);
+}
+
+} // namespace fpb::telemetry
+
+#endif // SURGE_MODULE_FLAPPY_BIRD_TELEMETRY_HPP
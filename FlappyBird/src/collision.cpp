@@ -0,0 +1,227 @@
+#include "flappy_bird.hpp"
+
+#include "sc_files.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__AVX2__) || defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+
+// Every bird sheet shares the silhouette of the red one, and every pipe the one of the green pipe
+static constexpr const char *bird_mask_sheet{"resources/sheets/bird_red.png"};
+static constexpr const char *pipe_mask_image{"resources/static/pipe-green.png"};
+
+static const glm::vec4 pipe_view{0.0f, 0.0f, 52.0f, 320.0f};
+
+// Rows of the narrow phase are gathered in blocks of this size
+static constexpr surge::usize block_rows{32};
+
+static auto solid_mask(const glm::vec4 &view) noexcept -> fpb::collision::mask {
+  const auto width{static_cast<surge::u32>(view[2])};
+  const auto height{static_cast<surge::u32>(view[3])};
+  const auto row{width >= 64 ? ~surge::u64{0} : (surge::u64{1} << width) - 1};
+
+  return fpb::collision::mask{width, height, surge::vector<surge::u64>(height, row)};
+}
+
+static auto image_mask(const surge::files::image &img, const glm::vec4 &view) noexcept
+    -> fpb::collision::mask {
+  auto m{solid_mask(view)};
+
+  // Images without an alpha channel are opaque everywhere
+  if (img.channels != 2 && img.channels != 4) {
+    return m;
+  }
+
+  const auto x0{static_cast<surge::usize>(view[0])};
+  const auto y0{static_cast<surge::usize>(view[1])};
+  const auto img_width{static_cast<surge::usize>(img.width)};
+  const auto channels{static_cast<surge::usize>(img.channels)};
+
+  for (surge::usize y = 0; y < m.height; y++) {
+    surge::u64 row{0};
+
+    for (surge::usize x = 0; x < m.width; x++) {
+      const auto alpha{img.texels[((y0 + y) * img_width + x0 + x) * channels + channels - 1]};
+      row |= alpha != 0 ? surge::u64{1} << x : 0;
+    }
+
+    m.rows[y] = row; // NOLINT
+  }
+
+  return m;
+}
+
+// Loads the masks of views of an image. Views that can not be read fall back to solid masks, which
+// is the same as colliding with the sprite rects.
+template <surge::usize N>
+static auto load_image_masks(const char *path, const std::array<glm::vec4, N> &views) noexcept
+    -> std::array<fpb::collision::mask, N> {
+  std::array<fpb::collision::mask, N> masks{};
+
+  for (surge::usize i = 0; i < N; i++) {
+    masks[i] = solid_mask(views[i]); // NOLINT
+  }
+
+  auto img{surge::files::load_image(path, false)};
+  if (!img) {
+    log_warn("Unable to load {}. Collisions will use the sprite rects", path);
+    return masks;
+  }
+
+  for (surge::usize i = 0; i < N; i++) {
+    const auto &v{views[i]}; // NOLINT
+
+    if (v[2] > 64.0f || v[0] + v[2] > static_cast<float>(img->width)
+        || v[1] + v[3] > static_cast<float>(img->height)) {
+      log_warn("Sprite view {} of {} does not fit a collision mask", i, path);
+      continue;
+    }
+
+    masks[i] = image_mask(*img, v); // NOLINT
+  }
+
+  surge::files::free_image(*img);
+
+  return masks;
+}
+
+static auto rotate_180(const fpb::collision::mask &m) noexcept -> fpb::collision::mask {
+  fpb::collision::mask r{m.width, m.height, surge::vector<surge::u64>(m.height, 0)};
+
+  for (surge::usize y = 0; y < m.height; y++) {
+    const auto row{m.rows[m.height - 1 - y]}; // NOLINT
+    surge::u64 mirrored{0};
+
+    for (surge::usize x = 0; x < m.width; x++) {
+      mirrored |= ((row >> x) & 1) << (m.width - 1 - x);
+    }
+
+    r.rows[y] = mirrored; // NOLINT
+  }
+
+  return r;
+}
+
+static auto bottom_row(const fpb::collision::mask &m) noexcept -> surge::u32 {
+  for (auto y = m.height; y > 0; y--) {
+    if (m.rows[y - 1] != 0) { // NOLINT
+      return y - 1;
+    }
+  }
+
+  return m.height - 1;
+}
+
+auto fpb::collision::load_masks() noexcept -> masks {
+  masks m{};
+
+  m.bird_frames = load_image_masks(bird_mask_sheet, entities::bird_frame_views);
+  m.pipe_down = load_image_masks(pipe_mask_image, std::array<glm::vec4, 1>{pipe_view})[0];
+
+  // The upper pipe is drawn as the lower one turned upside down
+  m.pipe_up = rotate_180(m.pipe_down);
+
+  for (surge::usize i = 0; i < m.bird_frames.size(); i++) {
+    m.bird_bottom_rows[i] = bottom_row(m.bird_frames[i]); // NOLINT
+  }
+
+  return m;
+}
+
+// True if any pair of rows shares a set bit
+static inline auto rows_intersect(const surge::u64 *a, const surge::u64 *b,
+                                  surge::usize count) noexcept -> bool {
+  surge::usize i{0};
+
+#if defined(__AVX2__)
+  auto acc{_mm256_setzero_si256()};
+
+  for (; i + 4 <= count; i += 4) {
+    const auto va{_mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + i))}; // NOLINT
+    const auto vb{_mm256_loadu_si256(reinterpret_cast<const __m256i *>(b + i))}; // NOLINT
+    acc = _mm256_or_si256(acc, _mm256_and_si256(va, vb));
+  }
+
+  if (_mm256_testz_si256(acc, acc) == 0) {
+    return true;
+  }
+#elif defined(__SSE2__) || defined(_M_X64)
+  auto acc{_mm_setzero_si128()};
+
+  for (; i + 2 <= count; i += 2) {
+    const auto va{_mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i))}; // NOLINT
+    const auto vb{_mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i))}; // NOLINT
+    acc = _mm_or_si128(acc, _mm_and_si128(va, vb));
+  }
+
+  if (_mm_movemask_epi8(_mm_cmpeq_epi8(acc, _mm_setzero_si128())) != 0xFFFF) {
+    return true;
+  }
+#endif
+
+  surge::u64 rest{0};
+
+  for (; i < count; i++) {
+    rest |= a[i] & b[i]; // NOLINT
+  }
+
+  return rest != 0;
+}
+
+auto fpb::collision::overlap(const mask &a, const glm::vec2 &a_pos, const glm::vec2 &a_bbox,
+                             const mask &b, const glm::vec2 &b_pos,
+                             const glm::vec2 &b_bbox) noexcept -> bool {
+  const auto a_texel_w{a_bbox[0] / static_cast<float>(a.width)};
+  const auto a_texel_h{a_bbox[1] / static_cast<float>(a.height)};
+  const auto b_texel_h{b_bbox[1] / static_cast<float>(b.height)};
+
+  // Columns of b line up with columns of a after a whole texel shift
+  const auto shift{static_cast<int>(std::lround((b_pos[0] - a_pos[0]) / a_texel_w))};
+  if (shift >= 64 || shift <= -64) {
+    return false;
+  }
+
+  const auto shift_left{static_cast<unsigned>(std::max(shift, 0))};
+  const auto shift_right{static_cast<unsigned>(std::max(-shift, 0))};
+
+  // Rows of a that fall inside b
+  const auto a_height{static_cast<float>(a.height)};
+  const auto first_row{static_cast<surge::usize>(
+      std::clamp(std::floor((b_pos[1] - a_pos[1]) / a_texel_h), 0.0f, a_height))};
+  const auto last_row{static_cast<surge::usize>(
+      std::clamp(std::ceil((b_pos[1] + b_bbox[1] - a_pos[1]) / a_texel_h), 0.0f, a_height))};
+
+  // b rows resampled at the centers of the rows of a and shifted into its columns. The row of b is
+  // stepped instead of divided out for every row of a.
+  const auto b_row_step{a_texel_h / b_texel_h};
+  auto b_row{(a_pos[1] - b_pos[1] + (static_cast<float>(first_row) + 0.5f) * a_texel_h)
+             / b_texel_h};
+
+  const auto b_height{static_cast<float>(b.height)};
+
+  std::array<surge::u64, block_rows> b_rows{};
+
+  for (auto block = first_row; block < last_row; block += block_rows) {
+    const auto count{std::min(block_rows, last_row - block)};
+
+    for (surge::usize i = 0; i < count; i++, b_row += b_row_step) {
+      surge::u64 bits{0};
+
+      // Truncation is the floor here since negative rows are skipped
+      if (b_row >= 0.0f && b_row < b_height) {
+        bits = (b.rows[static_cast<surge::usize>(b_row)] << shift_left) >> shift_right; // NOLINT
+      }
+
+      b_rows[i] = bits; // NOLINT
+    }
+
+    if (rows_intersect(a.rows.data() + block, b_rows.data(), count)) {
+      return true;
+    }
+  }
+
+  return false;
+}
@@ -0,0 +1,106 @@
+#include "flappy_bird.hpp"
+
+auto fpb::entities::make_layout(const glm::vec2 &window_dims) noexcept -> layout {
+  // Original sizes
+  const glm::vec2 original_window_size{288.0f, 512.0f};
+  const glm::vec2 original_bird_bbox{34.0f, 24.0f};
+  const glm::vec2 original_base_bbox{288.0f, 112.0f};
+  const glm::vec2 original_pipe_bbox{52.0f, 32.0f};
+
+  const glm::vec2 original_bird_sheet_size{141.0f, 26.0f};
+
+  const glm::vec2 original_instructions_1_size{184.0f, 152.0f};
+  const glm::vec2 original_instructions_2_size{114.0f, 60.0f};
+  const glm::vec2 original_game_over_size{192.0f, 42.0f};
+
+  const glm::vec2 original_numnbers_size{24.0f, 36.0f};
+
+  const auto scale_factor{window_dims / original_window_size};
+
+  layout l{};
+  l.window_dims = window_dims;
+  l.bird_sheet_size = original_bird_sheet_size;
+
+  // Base sizes
+  l.base_bbox = original_base_bbox * scale_factor;
+
+  // Bird sizes
+  l.bird_bbox = original_bird_bbox * scale_factor;
+  l.bird_origin = glm::vec2{window_dims[0] / 3.0f - l.bird_bbox[0] / 2.0f,
+                            window_dims[1] / 2.0f - l.bird_bbox[1] / 2.0f};
+
+  // Pipe sizes
+  l.pipe_gaps = glm::vec2{window_dims[0] / 2.0f, 150.0f};
+  l.pipe_bbox = glm::vec2{original_pipe_bbox[0] * scale_factor[0], window_dims[1]};
+
+  // Instructions size
+  l.instructions_1_bbox = original_instructions_1_size * scale_factor;
+  l.instructions_2_bbox = original_instructions_2_size * scale_factor;
+
+  // Game over screen size
+  l.game_over_bbox = original_game_over_size * scale_factor;
+
+  // Score numbers size
+  l.numbers_bbox = original_numnbers_size * scale_factor;
+
+  // Allowed pipe y range
+  const float allowed_pipe_area_fraction{(window_dims[1] - l.base_bbox[1]) / 4.0f};
+  l.pipe_y_min = allowed_pipe_area_fraction;
+  l.pipe_y_max = window_dims[1] - l.base_bbox[1] - allowed_pipe_area_fraction;
+
+  return l;
+}
+
+auto fpb::entities::create(const layout &l, surge::u32 seed) noexcept -> store {
+  store s{};
+  s.engine.seed(seed);
+  reset(s, l);
+  return s;
+}
+
+void fpb::entities::reset(store &s, const layout &l) noexcept {
+  // The RNG keeps running across resets, so replays stay deterministic
+  const auto engine{s.engine};
+  s = store{};
+  s.engine = engine;
+
+  const glm::vec2 drift_velocity{-80.0f, 0.0f};
+
+  // Rolling base
+  s.position[slot::base_l] = glm::vec2{0.0f, l.window_dims[1] - l.base_bbox[1]};
+  s.position[slot::base_r] = glm::vec2{l.base_bbox[0], l.window_dims[1] - l.base_bbox[1]};
+
+  for (surge::u32 i = slot::base_l; i <= slot::base_r; i++) {
+    s.velocity[i] = drift_velocity; // NOLINT
+    s.bbox[i] = l.base_bbox;        // NOLINT
+    s.depth[i] = 0.2f;              // NOLINT
+    s.sprite_ref[i] = sprite::base; // NOLINT
+  }
+
+  // Pipes, half a window apart starting at the right edge
+  for (surge::u32 i = 0; i < pipe_count; i++) {
+    const auto p{slot::pipe_0 + i};
+    const auto x{l.window_dims[0] + static_cast<float>(i) * l.window_dims[0] / 2.0f};
+
+    s.position[p] = glm::vec2{x, random_pipe_y(s, l)}; // NOLINT
+    s.velocity[p] = drift_velocity;                    // NOLINT
+    s.bbox[p] = l.pipe_bbox;                           // NOLINT
+    s.depth[p] = 0.15f;                                // NOLINT
+    s.sprite_ref[p] = sprite::pipe;                    // NOLINT
+  }
+
+  // Bird
+  s.position[slot::bird] = glm::vec2{l.bird_origin[0], l.bird_origin[1] - 10.0f};
+  s.velocity[slot::bird] = glm::vec2{0.0f};
+  s.bbox[slot::bird] = l.bird_bbox;
+  s.depth[slot::bird] = 0.3f;
+  s.sprite_ref[slot::bird] = sprite::bird;
+
+  // The first pipe starts to the right of the bird
+  s.prev_dist_sign = 1;
+}
+
+auto fpb::entities::random_pipe_y(store &s, const layout &l) noexcept -> float {
+  std::uniform_real_distribution<float> pipe_y_range{l.pipe_y_min, l.pipe_y_max};
+  return pipe_y_range(s.engine);
+}
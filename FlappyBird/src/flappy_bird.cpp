@@ -2,17 +2,136 @@
 
 #include "sc_glm_includes.hpp"
 
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
 namespace globals {
 
 static fpb::tdb_t tdb{};      // NOLINT
 static fpb::pvubo_t pv_ubo{}; // NOLINT
 static fpb::sdb_t sdb{};      // NOLINT
 
+static fpb::resources::loader loader{}; // NOLINT
+
 static fpb::state_machine::state state_a{}; // NOLINT
 static fpb::state_machine::state state_b{}; // NOLINT
+static fpb::state_machine::scene scene{};   // NOLINT
+
+// Frame pacing
+static double last_update{0.0}; // NOLINT
+static bool input_event{false}; // NOLINT
+
+static fpb::entities::store game{};       // NOLINT
+static fpb::collision::masks collision{}; // NOLINT
+
+// Practice mode
+static fpb::rewind::history history{}; // NOLINT
+
+// Replays
+static fpb::replay::recording recording{};             // NOLINT
+static surge::usize replay_cursor{0};                  // NOLINT
+static bool replay_presses_applied{false};             // NOLINT
+static const char *record_path{nullptr};               // NOLINT
+static fpb::video_export::exporter *exporter{nullptr}; // NOLINT
+
+// Theme key presses, applied on the next update so that replays see them on the same tick
+static surge::u32 pending_theme_presses{0}; // NOLINT
+
+// Telemetry
+static fpb::telemetry::record telemetry_record{}; // NOLINT
+#ifdef SURGE_MODULE_FLAPPY_BIRD_TELEMETRY
+static fpb::telemetry::writer telemetry_writer{}; // NOLINT
+#endif
 
 } // namespace globals
 
+static void fill_telemetry(const fpb::entities::store &game,
+                           const fpb::state_machine::state &state,
+                           fpb::telemetry::record &rec) noexcept {
+  using namespace fpb::entities;
+
+  static_assert(pipe_count <= fpb::telemetry::max_pipes);
+
+  std::snprintf(rec.state_name.data(), rec.state_name.size(), "%s",
+                fpb::state_machine::state_to_str(state));
+  rec.score = game.score;
+  rec.collided = game.collided;
+  rec.bird_y = game.position[slot::bird][1];
+  rec.bird_vy = game.velocity[slot::bird][1];
+  rec.pipe_count = pipe_count;
+
+  for (surge::u32 i = 0; i < pipe_count; i++) {
+    const auto &pipe{game.position[pipe_slot(game, i)]};
+    rec.pipes[2 * i] = pipe[0];     // NOLINT
+    rec.pipes[2 * i + 1] = pipe[1]; // NOLINT
+  }
+}
+
+static void cycle_theme() noexcept {
+  using namespace fpb::resources;
+
+  const auto next{static_cast<theme>((globals::loader.requested_theme + 1) % theme::count)};
+  request_theme(globals::tdb, globals::loader, next);
+}
+
+static void record_tick(window_t w, const fpb::replay::tick &tick) noexcept {
+  const auto dims{surge::window::get_dims(w)};
+
+  // Exports need the window size of the recording, so recording stops at the first resize. The
+  // ticks up to it still make a valid replay.
+  if (static_cast<surge::u32>(dims[0]) != globals::recording.window_width
+      || static_cast<surge::u32>(dims[1]) != globals::recording.window_height) {
+    log_warn("The window was resized. Recording stops here");
+    fpb::replay::save(globals::record_path, globals::recording);
+    globals::record_path = nullptr;
+    return;
+  }
+
+  globals::recording.ticks.push_back(tick);
+}
+
+// Update rates of screens that do not need the full frame rate. The engine presents after every
+// update, so frames are cut by blocking on window events until the next one is due. Key presses
+// and mouse clicks wake the game up at once, any other event (cursor motion, focus changes) only
+// goes back to waiting.
+static constexpr double idle_rate{10.0};
+static constexpr double attract_rate{30.0};
+
+static void throttle(window_t w) noexcept {
+  using namespace fpb::state_machine;
+
+  // Exports run as fast as frames can be produced
+  if (globals::exporter != nullptr) {
+    return;
+  }
+
+  // Play keeps the full rate even without focus, since the bird is still flying
+  const auto focused{glfwGetWindowAttrib(w, GLFW_FOCUSED) == GLFW_TRUE};
+  const auto playing{globals::state_a == state::play || globals::state_a == state::rewinding};
+
+  double rate{0.0};
+
+  if (globals::scene.idle || (!focused && !playing)) {
+    rate = idle_rate;
+  } else if (globals::state_a == state::prepare) {
+    rate = attract_rate;
+  } else {
+    return;
+  }
+
+  const auto next_update{globals::last_update + 1.0 / rate};
+
+  while (!globals::input_event && glfwWindowShouldClose(w) == GLFW_FALSE) {
+    const auto now{glfwGetTime()};
+    if (now >= next_update) {
+      break;
+    }
+
+    glfwWaitEventsTimeout(next_update - now);
+  }
+}
+
 extern "C" SURGE_MODULE_EXPORT auto gl_on_load(window_t w) noexcept -> int {
   using namespace surge;
   using namespace surge::gl_atom;
@@ -23,7 +142,8 @@ extern "C" SURGE_MODULE_EXPORT auto gl_on_load(window_t w) noexcept -> int {
   globals::tdb = texture::database::create(128);
 
   // Sprite database
-  const sprite_database::database_create_info sdb_ci{.max_sprites = 16, .buffer_redundancy = 3};
+  const sprite_database::database_create_info sdb_ci{
+      .max_sprites = 16, .buffer_redundancy = sprite_buffer_redundancy};
   auto sdb{sprite_database::create(sdb_ci)};
   if (!sdb) {
     log_error("Unable to create sprite database");
@@ -41,32 +161,61 @@ extern "C" SURGE_MODULE_EXPORT auto gl_on_load(window_t w) noexcept -> int {
   globals::pv_ubo = pv_ubo::buffer::create();
   globals::pv_ubo.update_all(&projection, &view);
 
-  // Load game resources
-  texture::create_info ci{};
-  ci.filtering = texture::texture_filtering::nearest;
-
-  // clang-format off
-  globals::tdb.add(
-    ci,
-    "resources/static/base.png",
-    "resources/static/background-day.png",
-    "resources/sheets/bird_red.png",
-    "resources/static/pipe-green.png",
-    "resources/text/instructions_1.png",
-    "resources/text/instructions_2.png",
-    "resources/text/gameover.png",
-    "resources/numbers/0.png",
-    "resources/numbers/1.png",
-    "resources/numbers/2.png",
-    "resources/numbers/3.png",
-    "resources/numbers/4.png",
-    "resources/numbers/5.png",
-    "resources/numbers/6.png",
-    "resources/numbers/7.png",
-    "resources/numbers/8.png",
-    "resources/numbers/9.png"
-  );
-  // clang-format on
+  // Collision masks are built from the sprite alpha, so they are ready before the first frame.
+  // They are built before streaming starts its decoder threads, which share the image loader.
+  globals::collision = collision::load_masks();
+
+  // Load game resources. Only the first frame is loaded here, the rest is streamed in gl_update
+  globals::loader.ci.filtering = texture::texture_filtering::nearest;
+  resources::load_first_frame(globals::tdb, globals::loader);
+
+  // Replays. FPB_RECORD saves the inputs of this session, FPB_EXPORT renders a saved one to
+  // FPB_EXPORT_OUTPUT instead of playing
+  const auto export_path{std::getenv("FPB_EXPORT")};
+  globals::record_path = std::getenv("FPB_RECORD");
+
+  if (export_path != nullptr) {
+    auto r{replay::load(export_path)};
+    if (!r) {
+      return 1;
+    }
+    globals::recording = std::move(*r);
+
+    // The layout is derived from the window size, so the pipes of a replay only line up in a
+    // window of the size it was recorded in
+    const auto width{static_cast<surge::u32>(dims[0])};
+    const auto height{static_cast<surge::u32>(dims[1])};
+
+    if (width != globals::recording.window_width || height != globals::recording.window_height) {
+      log_error("Replay {} was recorded in a {}x{} window and can not be exported from a {}x{} one",
+                export_path, globals::recording.window_width, globals::recording.window_height,
+                width, height);
+      return 1;
+    }
+
+    const auto export_output{std::getenv("FPB_EXPORT_OUTPUT")};
+    globals::exporter
+        = video_export::create(w, export_output != nullptr ? export_output : "export");
+    if (globals::exporter == nullptr) {
+      return 1;
+    }
+  } else {
+    globals::recording.seed = std::random_device{}();
+    globals::recording.window_width = static_cast<surge::u32>(dims[0]);
+    globals::recording.window_height = static_cast<surge::u32>(dims[1]);
+  }
+
+  // Game entities
+  globals::game = entities::create(entities::make_layout(dims), globals::recording.seed);
+
+#ifdef SURGE_MODULE_FLAPPY_BIRD_TELEMETRY
+  // Telemetry is best effort and never stops the game from loading
+  if (auto tw{telemetry::open_writer()}) {
+    globals::telemetry_writer = *tw;
+  } else {
+    log_warn("Unable to open the telemetry shared memory {}", telemetry::default_name);
+  }
+#endif
 
   // First state
   globals::state_b = state::prepare;
@@ -77,27 +226,168 @@ extern "C" SURGE_MODULE_EXPORT auto gl_on_load(window_t w) noexcept -> int {
 
 extern "C" SURGE_MODULE_EXPORT auto gl_on_unload(window_t) noexcept -> int {
   surge::renderer::gl::wait_idle();
+
+  if (globals::record_path != nullptr && globals::exporter == nullptr) {
+    fpb::replay::save(globals::record_path, globals::recording);
+  }
+
+  fpb::video_export::destroy(globals::exporter);
+  globals::exporter = nullptr;
+
+  fpb::rewind::log_capture_cost(globals::history);
+
+#ifdef SURGE_MODULE_FLAPPY_BIRD_TELEMETRY
+  fpb::telemetry::close_writer(globals::telemetry_writer);
+#endif
+
   globals::pv_ubo.destroy();
+  fpb::resources::unload(globals::loader);
   surge::gl_atom::sprite_database::destroy(globals::sdb);
   globals::tdb.destroy();
   return 0;
 }
 
 extern "C" SURGE_MODULE_EXPORT auto gl_draw(window_t) noexcept -> int {
+  const auto draw_start{std::chrono::steady_clock::now()};
+
+  if (globals::exporter != nullptr) {
+    fpb::video_export::begin_frame(globals::exporter);
+  }
+
   globals::pv_ubo.bind_to_location(2);
   surge::gl_atom::sprite_database::draw(globals::sdb);
+
+  if (globals::exporter != nullptr) {
+    fpb::video_export::end_frame(globals::exporter);
+  }
+
+  const auto draw_end{std::chrono::steady_clock::now()};
+  globals::telemetry_record.draw_us
+      = std::chrono::duration<float, std::micro>(draw_end - draw_start).count();
+
   return 0;
 }
 
 extern "C" SURGE_MODULE_EXPORT auto gl_update(window_t w, double dt) noexcept -> int {
+  using namespace fpb;
   using namespace fpb::state_machine;
+
+  throttle(w);
+  globals::last_update = glfwGetTime();
+  globals::input_event = false;
+
+  const auto update_start{std::chrono::steady_clock::now()};
+
+  auto button_down{surge::window::get_mouse_button(w, GLFW_MOUSE_BUTTON_LEFT) == GLFW_PRESS};
+
+  bool textures_ready{false};
+
+  if (globals::exporter != nullptr) {
+    // Exports run on the replay clock, as fast as frames can be produced
+    if (globals::replay_cursor == globals::recording.ticks.size()) {
+      fpb::video_export::destroy(globals::exporter);
+      globals::exporter = nullptr;
+      glfwSetWindowShouldClose(w, GLFW_TRUE);
+      return 0;
+    }
+
+    const auto &tick{globals::recording.ticks[globals::replay_cursor]};
+
+    if (!globals::replay_presses_applied) {
+      for (surge::u32 i = 0; i < tick.theme_presses; i++) {
+        cycle_theme();
+      }
+      globals::replay_presses_applied = true;
+    }
+
+    resources::stream(globals::tdb, globals::loader);
+
+    // Ticks that had the gameplay textures when they were recorded wait for them to stream in
+    textures_ready = tick.textures_ready != 0;
+    if (textures_ready && !resources::play_ready(globals::loader.active)) {
+      return 0;
+    }
+
+    globals::replay_cursor++;
+    globals::replay_presses_applied = false;
+
+    dt = static_cast<double>(tick.dt);
+    button_down = tick.button_down != 0;
+    video_export::advance(globals::exporter, dt);
+  } else {
+    const auto theme_presses{globals::pending_theme_presses};
+    globals::pending_theme_presses = 0;
+
+    for (surge::u32 i = 0; i < theme_presses; i++) {
+      cycle_theme();
+    }
+
+    resources::stream(globals::tdb, globals::loader);
+    textures_ready = resources::play_ready(globals::loader.active);
+
+    if (globals::record_path != nullptr) {
+      record_tick(w, replay::tick{static_cast<float>(dt), button_down ? 1u : 0u, theme_presses,
+                                  textures_ready ? 1u : 0u});
+    }
+  }
+
   state_transition(globals::state_a, globals::state_b);
-  state_update(w, globals::tdb, globals::sdb, globals::state_a, globals::state_b, dt);
+  state_update(w, globals::loader.active, globals::collision, globals::sdb, globals::game,
+               globals::history, globals::scene, globals::state_a, globals::state_b, button_down,
+               textures_ready, dt);
+
+  // Frame timings in the record are the ones of the previous frame
+  auto &rec{globals::telemetry_record};
+  rec.dt = static_cast<float>(dt);
+  fill_telemetry(globals::game, globals::state_a, rec);
+
+#ifdef SURGE_MODULE_FLAPPY_BIRD_TELEMETRY
+  if (globals::telemetry_writer.shm != nullptr) {
+    telemetry::publish(globals::telemetry_writer, rec);
+  }
+#endif
+
+  rec.tick++;
+
+  const auto update_end{std::chrono::steady_clock::now()};
+  rec.update_us = std::chrono::duration<float, std::micro>(update_end - update_start).count();
+
   return 0;
 }
 
-extern "C" SURGE_MODULE_EXPORT void gl_keyboard_event(window_t, int, int, int, int) noexcept {}
+extern "C" SURGE_MODULE_EXPORT void gl_keyboard_event(window_t, int key, int, int action,
+                                                      int) noexcept {
+  globals::input_event = true;
+
+  // Cycle themes. Exports replay the recorded presses instead.
+  if (key == GLFW_KEY_T && action == GLFW_PRESS && globals::exporter == nullptr) {
+    globals::pending_theme_presses++;
+  }
+
+  // Toggle practice mode. Replays only hold inputs, so rewinding would break them.
+  if (key == GLFW_KEY_P && action == GLFW_PRESS) {
+    if (globals::record_path != nullptr || globals::exporter != nullptr) {
+      log_warn("Practice mode is not available while recording or exporting replays");
+      return;
+    }
+
+    globals::history.enabled = !globals::history.enabled;
+
+    // Ticks captured before practice was last turned off are not part of this run. A rewind in
+    // progress is still walking the history of this run, so it is kept.
+    const auto rewinding{globals::state_a == fpb::state_machine::state::rewinding
+                         || globals::state_b == fpb::state_machine::state::rewinding};
 
-extern "C" SURGE_MODULE_EXPORT void gl_mouse_button_event(window_t, int, int, int) noexcept {}
+    if (globals::history.enabled && !rewinding) {
+      fpb::rewind::clear(globals::history);
+    }
+
+    log_info("Practice mode {}", globals::history.enabled ? "on" : "off");
+  }
+}
+
+extern "C" SURGE_MODULE_EXPORT void gl_mouse_button_event(window_t, int, int, int) noexcept {
+  globals::input_event = true;
+}
 
 extern "C" SURGE_MODULE_EXPORT void gl_mouse_scroll_event(window_t, double, double) noexcept {}
\ No newline at end of file
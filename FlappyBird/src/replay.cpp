@@ -0,0 +1,86 @@
+#include "flappy_bird.hpp"
+
+#include <cstdio>
+
+struct replay_header {
+  std::array<char, 4> magic{'F', 'P', 'B', 'R'};
+  surge::u32 version{2};
+  surge::u32 seed{0};
+  surge::u32 window_width{0};
+  surge::u32 window_height{0};
+  surge::u32 padding{0};
+  surge::u64 tick_count{0};
+};
+
+auto fpb::replay::load(const char *path) noexcept -> std::optional<recording> {
+  auto file{std::fopen(path, "rb")};
+  if (file == nullptr) {
+    log_error("Unable to open replay file {}", path);
+    return {};
+  }
+
+  replay_header header{};
+  const replay_header expected_header{};
+
+  if (std::fread(&header, sizeof(replay_header), 1, file) != 1
+      || header.magic != expected_header.magic || header.version != expected_header.version) {
+    log_error("{} is not a valid replay file", path);
+    std::fclose(file);
+    return {};
+  }
+
+  // The tick count is checked against what the file holds before anything is allocated for it
+  std::fseek(file, 0, SEEK_END);
+  const auto file_size{std::ftell(file)};
+  std::fseek(file, static_cast<long>(sizeof(replay_header)), SEEK_SET);
+
+  const auto tick_bytes{static_cast<surge::u64>(file_size) - sizeof(replay_header)};
+  if (file_size < 0 || header.tick_count > tick_bytes / sizeof(tick)) {
+    log_error("Replay file {} is truncated", path);
+    std::fclose(file);
+    return {};
+  }
+
+  recording r{};
+  r.seed = header.seed;
+  r.window_width = header.window_width;
+  r.window_height = header.window_height;
+  r.ticks.resize(header.tick_count);
+
+  if (std::fread(r.ticks.data(), sizeof(tick), r.ticks.size(), file) != r.ticks.size()) {
+    log_error("Replay file {} is truncated", path);
+    std::fclose(file);
+    return {};
+  }
+
+  std::fclose(file);
+  return r;
+}
+
+auto fpb::replay::save(const char *path, const recording &r) noexcept -> bool {
+  auto file{std::fopen(path, "wb")};
+  if (file == nullptr) {
+    log_error("Unable to open replay file {}", path);
+    return false;
+  }
+
+  replay_header header{};
+  header.seed = r.seed;
+  header.window_width = r.window_width;
+  header.window_height = r.window_height;
+  header.tick_count = r.ticks.size();
+
+  const auto ok{std::fwrite(&header, sizeof(replay_header), 1, file) == 1
+                && std::fwrite(r.ticks.data(), sizeof(tick), r.ticks.size(), file)
+                       == r.ticks.size()};
+
+  std::fclose(file);
+
+  if (!ok) {
+    log_error("Unable to write replay file {}", path);
+  } else {
+    log_info("Saved {} replay ticks to {}", r.ticks.size(), path);
+  }
+
+  return ok;
+}
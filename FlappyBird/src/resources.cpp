@@ -0,0 +1,503 @@
+#include "flappy_bird.hpp"
+
+#include "sc_files.hpp"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <thread>
+
+struct theme_paths {
+  const char *background;
+  const char *pipe;
+  const char *bird_sheet;
+};
+
+// clang-format off
+static constexpr std::array<theme_paths, fpb::resources::theme::count> theme_table{{
+  {"resources/static/background-day.png", "resources/static/pipe-green.png", "resources/sheets/bird_red.png"},
+  {"resources/static/background-night.png", "resources/static/pipe-red.png", "resources/sheets/bird_blue.png"},
+  {"resources/static/background-day.png", "resources/static/pipe-red.png", "resources/sheets/bird_yellow.png"}
+}};
+
+static constexpr std::array<const char *, 10> number_paths{
+  "resources/numbers/0.png",
+  "resources/numbers/1.png",
+  "resources/numbers/2.png",
+  "resources/numbers/3.png",
+  "resources/numbers/4.png",
+  "resources/numbers/5.png",
+  "resources/numbers/6.png",
+  "resources/numbers/7.png",
+  "resources/numbers/8.png",
+  "resources/numbers/9.png"
+};
+// clang-format on
+
+// Streamed images are decoded by this many worker threads
+static constexpr surge::usize decoder_count{2};
+
+// The staging buffer is split in one segment per frame in flight, and each frame fills at most one
+// segment. The segment size is the upload budget of a frame.
+static constexpr surge::usize staging_segments{3};
+static constexpr surge::usize staging_segment_size{256 * 1024};
+
+struct decoded_image {
+  const char *path{nullptr};
+  surge::files::image img{};
+};
+
+struct streamed_texture {
+  const char *path{nullptr};
+  GLuint texture{0};
+  GLuint64 handle{0};
+};
+
+struct fpb::resources::uploader {
+  // Decoders
+  std::mutex mutex{};
+  std::condition_variable work{};
+  surge::deque<const char *> pending{};
+  surge::deque<decoded_image> decoded{};
+  bool stop{false};
+  surge::vector<std::thread> workers{};
+
+  // Every path ever queued, so that nothing is decoded twice
+  surge::vector<const char *> requested{};
+
+  // Persistently mapped staging buffer
+  GLuint staging{0};
+  surge::u8 *staging_data{nullptr};
+  std::array<GLsync, staging_segments> fences{};
+  surge::usize segment{0};
+
+  // Upload in progress
+  decoded_image current{};
+  GLuint current_texture{0};
+  surge::usize current_row{0};
+
+  surge::vector<streamed_texture> textures{};
+};
+
+static inline auto same_path(const char *a, const char *b) noexcept -> bool {
+  return std::strcmp(a, b) == 0;
+}
+
+static auto find(const fpb::tdb_t &tdb, const fpb::resources::loader &l,
+                 const char *path) noexcept -> GLuint64 {
+  const auto handle{tdb.find(path).value_or(0)};
+  if (handle != 0 || l.async == nullptr) {
+    return handle;
+  }
+
+  for (const auto &t : l.async->textures) {
+    if (same_path(t.path, path)) {
+      return t.handle;
+    }
+  }
+
+  return 0;
+}
+
+static void decoder_worker(fpb::resources::uploader &u) noexcept {
+  while (true) {
+    const char *path{nullptr};
+
+    {
+      std::unique_lock lock{u.mutex};
+      u.work.wait(lock, [&] { return u.stop || !u.pending.empty(); });
+
+      if (u.stop) {
+        return;
+      }
+
+      path = u.pending.front();
+      u.pending.pop_front();
+    }
+
+    // The flip flag of the decoder may be shared by every thread, so workers never flip and
+    // every call made while they run asks for the same orientation. upload flips the rows instead.
+    auto img{surge::files::load_image(path, false)};
+    if (!img) {
+      log_error("Unable to decode {}", path);
+      continue;
+    }
+
+    std::lock_guard lock{u.mutex};
+    u.decoded.push_back(decoded_image{path, *img});
+  }
+}
+
+// Queues a path for decoding. Urgent paths go ahead of everything still waiting for a decoder.
+static void request(fpb::resources::uploader &u, const char *path, bool urgent) noexcept {
+  {
+    std::lock_guard lock{u.mutex};
+
+    const auto waiting{std::find_if(u.pending.begin(), u.pending.end(),
+                                    [&](const char *p) { return same_path(p, path); })};
+
+    if (waiting != u.pending.end()) {
+      if (urgent) {
+        u.pending.erase(waiting);
+        u.pending.push_front(path);
+      }
+      return;
+    }
+
+    const auto queued{std::any_of(u.requested.begin(), u.requested.end(),
+                                  [&](const char *p) { return same_path(p, path); })};
+    if (queued) {
+      return;
+    }
+
+    u.requested.push_back(path);
+
+    if (urgent) {
+      u.pending.push_front(path);
+    } else {
+      u.pending.push_back(path);
+    }
+  }
+
+  u.work.notify_one();
+}
+
+// Decoded images are top row first, while the texture database flips its images so that the first
+// row is the bottom of the texture. Texture row r is therefore image row height - 1 - r.
+static inline auto image_row(const surge::files::image &img, surge::usize texture_row) noexcept
+    -> const surge::u8 * {
+  const auto height{static_cast<surge::usize>(img.height)};
+  const auto row_bytes{static_cast<surge::usize>(img.width * img.channels)};
+  return img.texels + (height - 1 - texture_row) * row_bytes; // NOLINT
+}
+
+// Makes the next decoded image the upload in progress. False if there is none.
+static auto next_upload(fpb::resources::uploader &u,
+                        const surge::gl_atom::texture::create_info &ci) noexcept -> bool {
+  using namespace surge::gl_atom;
+
+  while (u.current.path == nullptr) {
+    {
+      std::lock_guard lock{u.mutex};
+
+      if (u.decoded.empty()) {
+        return false;
+      }
+
+      u.current = u.decoded.front();
+      u.decoded.pop_front();
+    }
+
+    const auto &img{u.current.img};
+
+    if (img.channels != 3 && img.channels != 4) {
+      log_error("Unable to stream {}: {} channel images are not supported", u.current.path,
+                img.channels);
+      surge::files::free_image(u.current.img);
+      u.current = decoded_image{};
+      continue;
+    }
+
+    const auto filter{ci.filtering == texture::texture_filtering::nearest ? GL_NEAREST : GL_LINEAR};
+
+    glCreateTextures(GL_TEXTURE_2D, 1, &u.current_texture);
+    glTextureStorage2D(u.current_texture, 1, GL_RGBA8, img.width, img.height);
+    glTextureParameteri(u.current_texture, GL_TEXTURE_MIN_FILTER, filter);
+    glTextureParameteri(u.current_texture, GL_TEXTURE_MAG_FILTER, filter);
+    glTextureParameteri(u.current_texture, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTextureParameteri(u.current_texture, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    u.current_row = 0;
+  }
+
+  return true;
+}
+
+// The upload in progress is complete. Its handle is only made resident now, so resolve never sees a
+// partially uploaded texture.
+static void finish_upload(fpb::resources::uploader &u) noexcept {
+  const auto handle{glGetTextureHandleARB(u.current_texture)};
+  glMakeTextureHandleResidentARB(handle);
+
+  u.textures.push_back(streamed_texture{u.current.path, u.current_texture, handle});
+
+  surge::files::free_image(u.current.img);
+  u.current = decoded_image{};
+  u.current_texture = 0;
+}
+
+static void upload(fpb::resources::uploader &u,
+                   const surge::gl_atom::texture::create_info &ci) noexcept {
+  // A segment is reused staging_segments frames later. If the GPU is somehow still reading from it,
+  // the upload skips a frame instead of stalling it.
+  auto &fence{u.fences[u.segment]}; // NOLINT
+  if (fence != nullptr) {
+    if (glClientWaitSync(fence, 0, 0) == GL_TIMEOUT_EXPIRED) {
+      return;
+    }
+
+    glDeleteSync(fence);
+    fence = nullptr;
+  }
+
+  const auto segment_offset{u.segment * staging_segment_size};
+  surge::usize used{0};
+
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+  // Small images share a segment, large ones are split over several frames
+  while (used < staging_segment_size && next_upload(u, ci)) {
+    const auto &img{u.current.img};
+    const auto height{static_cast<surge::usize>(img.height)};
+    const auto width{static_cast<surge::usize>(img.width)};
+    const auto row_bytes{width * static_cast<surge::usize>(img.channels)};
+
+    const auto rows{std::min(height - u.current_row, (staging_segment_size - used) / row_bytes)};
+    if (rows == 0) {
+      break;
+    }
+
+    const auto format{img.channels == 4 ? GL_RGBA : GL_RGB};
+
+    if (u.staging_data != nullptr) {
+      // Rows are flipped while they are copied into the staging segment
+      const auto offset{segment_offset + used};
+
+      for (surge::usize r = 0; r < rows; r++) {
+        std::memcpy(u.staging_data + offset + r * row_bytes, image_row(img, u.current_row + r),
+                    row_bytes); // NOLINT
+      }
+
+      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, u.staging);
+      glTextureSubImage2D(u.current_texture, 0, 0, static_cast<GLint>(u.current_row), img.width,
+                          static_cast<GLsizei>(rows), format, GL_UNSIGNED_BYTE,
+                          reinterpret_cast<const void *>(offset)); // NOLINT
+      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    } else {
+      // Without staging memory to flip into, rows go up one at a time
+      for (surge::usize r = 0; r < rows; r++) {
+        glTextureSubImage2D(u.current_texture, 0, 0, static_cast<GLint>(u.current_row + r),
+                            img.width, 1, format, GL_UNSIGNED_BYTE,
+                            image_row(img, u.current_row + r));
+      }
+    }
+
+    used += rows * row_bytes;
+    u.current_row += rows;
+
+    if (u.current_row == height) {
+      finish_upload(u);
+    }
+  }
+
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+  if (used != 0 && u.staging_data != nullptr) {
+    fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    u.segment = (u.segment + 1) % staging_segments;
+  }
+}
+
+static auto create_uploader() noexcept -> fpb::resources::uploader * {
+  auto u{new fpb::resources::uploader{}};
+
+  const auto staging_size{static_cast<GLsizeiptr>(staging_segments * staging_segment_size)};
+  const GLbitfield staging_flags{GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT};
+
+  glCreateBuffers(1, &u->staging);
+  glNamedBufferStorage(u->staging, staging_size, nullptr, staging_flags);
+  u->staging_data = static_cast<surge::u8 *>(
+      glMapNamedBufferRange(u->staging, 0, staging_size, staging_flags));
+
+  if (u->staging_data == nullptr) {
+    log_warn("Unable to map the texture staging buffer. Streamed textures will upload directly");
+  }
+
+  for (surge::usize i = 0; i < decoder_count; i++) {
+    u->workers.emplace_back(decoder_worker, std::ref(*u));
+  }
+
+  return u;
+}
+
+static void resolve(const fpb::tdb_t &tdb, fpb::resources::loader &l) noexcept {
+  using namespace fpb::resources;
+
+  // Shared textures are used as soon as they are resident
+  l.active.base = find(tdb, l, "resources/static/base.png");
+  l.active.instructions_1 = find(tdb, l, "resources/text/instructions_1.png");
+  l.active.instructions_2 = find(tdb, l, "resources/text/instructions_2.png");
+  l.active.game_over = find(tdb, l, "resources/text/gameover.png");
+
+  for (surge::usize i = 0; i < number_paths.size(); i++) {
+    l.active.numbers[i] = find(tdb, l, number_paths[i]); // NOLINT
+  }
+
+  // Themed textures are swapped as a unit, so a half loaded theme is never drawn
+  const auto &paths{theme_table[l.requested_theme]}; // NOLINT
+  const auto background{find(tdb, l, paths.background)};
+  const auto pipe{find(tdb, l, paths.pipe)};
+  const auto bird_sheet{find(tdb, l, paths.bird_sheet)};
+
+  if (background == 0 || pipe == 0 || bird_sheet == 0) {
+    return;
+  }
+
+  l.active.background = background;
+  l.active.pipe = pipe;
+  l.active.bird_sheet = bird_sheet;
+
+  if (l.active_theme != l.requested_theme) {
+    log_info("Switched to theme {}", theme_to_str(l.requested_theme));
+    l.active_theme = l.requested_theme;
+  }
+}
+
+void fpb::resources::load_first_frame(tdb_t &tdb, loader &l) noexcept {
+  // The prepare screen is the only thing that needs to be resident before the first frame. The
+  // pipe is loaded with it because themed textures are only ever swapped in together.
+  const auto &paths{theme_table[l.active_theme]}; // NOLINT
+
+  // clang-format off
+  tdb.add(
+    l.ci,
+    "resources/static/base.png",
+    paths.background,
+    paths.bird_sheet,
+    paths.pipe,
+    "resources/text/instructions_1.png",
+    "resources/text/instructions_2.png"
+  );
+  // clang-format on
+
+  // Everything else is streamed in the background, starting with what the play state needs
+  l.async = create_uploader();
+
+  request(*l.async, "resources/text/gameover.png", false);
+
+  for (const auto path : number_paths) {
+    request(*l.async, path, false);
+  }
+
+  for (surge::u32 t = 0; t < theme::count; t++) {
+    const auto &other{theme_table[t]}; // NOLINT
+
+    // Themes share some textures with the first frame
+    for (const auto path : {other.background, other.pipe, other.bird_sheet}) {
+      if (find(tdb, l, path) == 0) {
+        request(*l.async, path, false);
+      }
+    }
+  }
+
+  resolve(tdb, l);
+}
+
+void fpb::resources::stream(const tdb_t &tdb, loader &l) noexcept {
+  if (l.async != nullptr) {
+    upload(*l.async, l.ci);
+  }
+
+  resolve(tdb, l);
+}
+
+void fpb::resources::request_theme(const tdb_t &tdb, loader &l, theme t) noexcept {
+  l.requested_theme = t;
+
+  // Bump the textures of the requested theme ahead of anything else still waiting to be decoded
+  const auto &paths{theme_table[t]}; // NOLINT
+
+  if (l.async != nullptr) {
+    for (const auto path : {paths.background, paths.pipe, paths.bird_sheet}) {
+      if (find(tdb, l, path) == 0) {
+        request(*l.async, path, true);
+      }
+    }
+  }
+
+  // Already resident themes switch immediately
+  resolve(tdb, l);
+}
+
+void fpb::resources::unload(loader &l) noexcept {
+  if (l.async == nullptr) {
+    return;
+  }
+
+  auto &u{*l.async};
+
+  {
+    std::lock_guard lock{u.mutex};
+    u.stop = true;
+  }
+
+  u.work.notify_all();
+
+  for (auto &worker : u.workers) {
+    worker.join();
+  }
+
+  for (auto &d : u.decoded) {
+    surge::files::free_image(d.img);
+  }
+
+  if (u.current.path != nullptr) {
+    surge::files::free_image(u.current.img);
+    glDeleteTextures(1, &u.current_texture);
+  }
+
+  for (const auto &t : u.textures) {
+    glMakeTextureHandleNonResidentARB(t.handle);
+    glDeleteTextures(1, &t.texture);
+  }
+
+  for (const auto fence : u.fences) {
+    if (fence != nullptr) {
+      glDeleteSync(fence);
+    }
+  }
+
+  glUnmapNamedBuffer(u.staging);
+  glDeleteBuffers(1, &u.staging);
+
+  delete l.async;
+  l.async = nullptr;
+
+  l.active = handles{};
+}
+
+auto fpb::resources::play_ready(const handles &h) noexcept -> bool {
+  if (h.pipe == 0 || h.game_over == 0) {
+    return false;
+  }
+
+  for (const auto number : h.numbers) {
+    if (number == 0) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+auto fpb::resources::theme_to_str(const theme &t) noexcept -> const char * {
+  using namespace fpb::resources;
+
+  switch (t) {
+  case theme::classic:
+    return "classic";
+
+  case theme::night:
+    return "night";
+
+  case theme::canary:
+    return "canary";
+
+  case theme::count:
+    return "count";
+
+  default:
+    return "unknown theme";
+  }
+}
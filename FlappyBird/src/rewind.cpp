@@ -0,0 +1,173 @@
+#include "flappy_bird.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cstring>
+
+using store_words_t = std::array<surge::u32, fpb::rewind::store_words>;
+
+static inline auto to_words(const fpb::entities::store &s) noexcept -> store_words_t {
+  store_words_t w{};
+  std::memcpy(w.data(), &s, sizeof(fpb::entities::store));
+  return w;
+}
+
+static inline void from_words(const store_words_t &w, fpb::entities::store &s) noexcept {
+  std::memcpy(static_cast<void *>(&s), w.data(), sizeof(fpb::entities::store));
+}
+
+// Packs the words of s that differ from key into f. False if there are more than a delta holds.
+static inline auto encode(const fpb::entities::store &key, const fpb::entities::store &s,
+                          fpb::rewind::frame &f) noexcept -> bool {
+  using namespace fpb::rewind;
+
+  const auto key_words{to_words(key)};
+  const auto s_words{to_words(s)};
+
+  f.changed = {};
+  f.word_count = 0;
+
+  for (surge::usize i = 0; i < store_words; i++) {
+    if (s_words[i] == key_words[i]) { // NOLINT
+      continue;
+    }
+
+    if (f.word_count == max_delta_words) {
+      return false;
+    }
+
+    f.words[f.word_count++] = s_words[i];            // NOLINT
+    f.changed[i / 64] |= surge::u64{1} << (i % 64); // NOLINT
+  }
+
+  return true;
+}
+
+static inline void take_key(fpb::rewind::history &h, const fpb::entities::store &s,
+                            fpb::rewind::frame &f) noexcept {
+  using namespace fpb::rewind;
+
+  // The key in this slot goes away, and with it the oldest ticks that were deltas against it
+  if (h.keys_taken >= key_capacity) {
+    const auto evicted{h.keys_taken - key_capacity};
+
+    while (h.oldest < h.frames_taken
+           && h.frames[h.oldest % frame_capacity].key <= evicted) { // NOLINT
+      h.oldest++;
+    }
+  }
+
+  h.keys[h.keys_taken % key_capacity] = s; // NOLINT
+
+  f.key = h.keys_taken;
+  f.changed = {};
+  f.word_count = 0;
+
+  h.keys_taken++;
+  h.since_key = 0;
+}
+
+void fpb::rewind::clear(history &h) noexcept {
+  h.keys_taken = 0;
+  h.frames_taken = 0;
+  h.oldest = 0;
+  h.since_key = 0;
+  h.cursor = 0;
+  h.remaining = 0.0f;
+}
+
+auto fpb::rewind::empty(const history &h) noexcept -> bool {
+  return h.frames_taken == h.oldest;
+}
+
+void fpb::rewind::capture(history &h, const entities::store &s, float dt) noexcept {
+  const auto capture_start{std::chrono::steady_clock::now()};
+
+  if (h.frames_taken - h.oldest == frame_capacity) {
+    h.oldest++;
+  }
+
+  auto &f{h.frames[h.frames_taken % frame_capacity]}; // NOLINT
+  f.dt = dt;
+
+  if (h.keys_taken == 0 || h.since_key >= key_interval) {
+    take_key(h, s, f);
+  } else {
+    f.key = h.keys_taken - 1;
+
+    if (!encode(h.keys[f.key % key_capacity], s, f)) { // NOLINT
+      take_key(h, s, f);
+    }
+  }
+
+  h.since_key++;
+  h.frames_taken++;
+
+  const auto capture_end{std::chrono::steady_clock::now()};
+  const auto capture_us{
+      std::chrono::duration<double, std::micro>(capture_end - capture_start).count()};
+
+  h.capture_count++;
+  h.capture_us_total += capture_us;
+  h.capture_us_max = std::max(h.capture_us_max, capture_us);
+}
+
+auto fpb::rewind::begin(history &h, float seconds) noexcept -> bool {
+  if (empty(h)) {
+    return false;
+  }
+
+  h.cursor = h.frames_taken - 1;
+  h.remaining = seconds;
+  return true;
+}
+
+auto fpb::rewind::step_back(history &h) noexcept -> float {
+  if (h.cursor == h.oldest) {
+    return 0.0f;
+  }
+
+  const auto dt{h.frames[h.cursor % frame_capacity].dt}; // NOLINT
+  h.cursor--;
+  return dt;
+}
+
+void fpb::rewind::restore(const history &h, entities::store &s) noexcept {
+  const auto &f{h.frames[h.cursor % frame_capacity]}; // NOLINT
+  auto words{to_words(h.keys[f.key % key_capacity])}; // NOLINT
+
+  surge::u32 next{0};
+
+  for (surge::usize i = 0; i < changed_words; i++) {
+    auto bits{f.changed[i]}; // NOLINT
+
+    while (bits != 0) {
+      const auto bit{static_cast<surge::usize>(std::countr_zero(bits))};
+      words[i * 64 + bit] = f.words[next++]; // NOLINT
+      bits &= bits - 1;
+    }
+  }
+
+  from_words(words, s);
+}
+
+void fpb::rewind::resume(history &h) noexcept {
+  // Keys taken after the cursor only describe the dropped ticks. How many ticks the cursor is past
+  // its own key is not kept, so the next tick simply starts a new one.
+  h.frames_taken = h.cursor + 1;
+  h.keys_taken = h.frames[h.cursor % frame_capacity].key + 1; // NOLINT
+  h.since_key = key_interval;
+  h.remaining = 0.0f;
+}
+
+void fpb::rewind::log_capture_cost(const history &h) noexcept {
+  if (h.capture_count == 0) {
+    return;
+  }
+
+  log_info("Rewind history of {} KiB captured {} ticks, {:.3f} us per tick on average and {:.3f} "
+           "us at most",
+           sizeof(history) / 1024, h.capture_count,
+           h.capture_us_total / static_cast<double>(h.capture_count), h.capture_us_max);
+}
@@ -27,6 +27,9 @@ auto fpb::state_machine::state_to_str(const state &s) noexcept -> const char * {
   case state::score:
     return "score";
 
+  case state::rewinding:
+    return "rewinding";
+
   case state::count:
     return "count";
 
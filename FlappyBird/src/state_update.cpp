@@ -1,9 +1,10 @@
 #include "flappy_bird.hpp"
 #include "sc_glm_includes.hpp"
 
+#include <algorithm>
 #include <cmath>
 
-using pipe_queue_t = surge::deque<glm::vec2>;
+using namespace fpb::entities;
 
 using acceleration_function = float (*)(float y, float y0);
 
@@ -47,160 +48,141 @@ static inline auto num_digits(surge::u64 number) noexcept -> surge::u64 {
 static inline auto harmonic_oscillator(float y, float y0) -> float { return -50.0f * (y - y0); }
 static inline auto gravity(float, float) -> float { return 1000.0f; }
 
-static inline void update_background(const fpb::tdb_t &tdb, fpb::sdb_t &sdb,
+static inline void update_background(const fpb::resources::handles &textures, fpb::sdb_t &sdb,
                                      const glm::vec2 &window_dims) noexcept {
   using namespace surge::gl_atom;
 
-  static const auto bckg_texture{tdb.find("resources/static/background-day.png").value_or(0)};
   const auto bckg_model{sprite_database::place_sprite(glm::vec2{0.0f}, window_dims, 0.1f)};
 
-  sprite_database::add(sdb, bckg_texture, bckg_model);
+  sprite_database::add(sdb, textures.background, bckg_model);
 }
 
-static inline void update_rolling_base(const fpb::tdb_t &tdb, fpb::sdb_t &sdb,
-                                       const glm::vec2 &window_dims, const glm::vec2 &base_bbox,
-                                       float delta_t) noexcept {
-  using namespace surge::gl_atom;
-
-  static const auto base_texture{tdb.find("resources/static/base.png").value_or(0)};
+// Fixed steps a single update may take. Enough to keep the 10 fps idle screens moving at full
+// speed, while a long stall (a dragged window, a breakpoint) drops the time it lost instead of
+// moving the bird and the pipes through each other between two collision checks.
+static constexpr int max_catch_up_steps{6};
 
-  static glm::vec2 base_corner_l{0.0, window_dims[1] - base_bbox[1]};
-  static glm::vec2 base_corner_r{base_bbox[0], window_dims[1] - base_bbox[1]};
-
-  const float drift_speed{80.0f};
+// Moves the entities in [first, last) along their velocities
+static inline void update_scroll(store &s, surge::u32 first, surge::u32 last,
+                                 float delta_t) noexcept {
   const float dt{1.0f / 60.0f};
 
-  static float elapsed{0.0f};
-  elapsed += delta_t;
+  s.scroll_elapsed = std::min(s.scroll_elapsed + delta_t, max_catch_up_steps * dt);
 
-  if (elapsed > dt) {
-    base_corner_l[0] -= drift_speed * dt;
-    base_corner_r[0] -= drift_speed * dt;
-    elapsed -= dt;
+  // Throttled frames take several steps
+  while (s.scroll_elapsed > dt) {
+    for (auto i = first; i < last; i++) {
+      s.position[i] += s.velocity[i] * dt; // NOLINT
+    }
+    s.scroll_elapsed -= dt;
   }
+}
+
+static inline void update_rolling_base(store &s) noexcept {
+  auto &base_corner_l{s.position[slot::base_l]};
+  auto &base_corner_r{s.position[slot::base_r]};
+  const auto base_width{s.bbox[slot::base_l][0]};
 
-  if (base_corner_l[0] < 0.0f && (base_bbox[0] + base_corner_l[0]) < 1.0e-6) {
-    base_corner_l[0] = base_bbox[0];
+  if (base_corner_l[0] < 0.0f && (base_width + base_corner_l[0]) < 1.0e-6) {
+    base_corner_l[0] = base_width;
     base_corner_r[0] = 0.0f;
   }
 
-  if (base_corner_r[0] < 0.0f && (base_bbox[0] + base_corner_r[0]) < 1.0e-6) {
-    base_corner_r[0] = base_bbox[0];
+  if (base_corner_r[0] < 0.0f && (base_width + base_corner_r[0]) < 1.0e-6) {
+    base_corner_r[0] = base_width;
     base_corner_l[0] = 0.0f;
   }
+}
 
-  const auto base_model_l{sprite_database::place_sprite(base_corner_l, base_bbox, 0.2f)};
-  const auto base_model_r{sprite_database::place_sprite(base_corner_r, base_bbox, 0.2f)};
+static inline void update_pipes(store &s, const layout &l) noexcept {
+  // Once the leftmost pipe leaves the screen, it is recycled as the rightmost one
+  const auto leftmost{pipe_slot(s, 0)};
 
-  sprite_database::add(sdb, base_texture, base_model_l);
-  sprite_database::add(sdb, base_texture, base_model_r);
-}
+  if ((s.position[leftmost][0] + s.bbox[leftmost][0]) < 0) {
+    const auto rightmost{pipe_slot(s, pipe_count - 1)};
+    const auto x{s.position[rightmost][0] + l.window_dims[0] / 2.0f};
 
-static inline auto update_bird_flap_animation_frame(float delta_t) noexcept -> glm::vec4 {
-  static const std::array<glm::vec4, 4> frame_views{
-      glm::vec4{1.0f, 1.0f, 34.0f, 24.0f}, glm::vec4{36.0f, 1.0f, 34.0f, 24.0f},
-      glm::vec4{71.0f, 1.0f, 34.0f, 24.0f}, glm::vec4{106.0f, 1.0f, 34.0f, 24.0f}};
+    s.position[leftmost] = glm::vec2{x, random_pipe_y(s, l)};
+    s.first_pipe = (s.first_pipe + 1) % pipe_count;
+  }
+}
 
+static inline void update_bird_flap_animation_frame(store &s, float delta_t) noexcept {
   static const float frame_rate{10.0f};
   static const float wait_time{1.0f / frame_rate};
 
-  static surge::u8 frame_idx{0};
-  static float elapsed{0.0f};
-
-  if (elapsed > wait_time) {
-    frame_idx++;
-    frame_idx %= 4;
-    elapsed = 0;
+  if (s.flap_elapsed > wait_time) {
+    s.flap_frame = (s.flap_frame + 1) % 4;
+    s.flap_elapsed = 0;
   } else {
-    elapsed += delta_t;
+    s.flap_elapsed += delta_t;
   }
-
-  return frame_views[frame_idx]; // NOLINT
 }
 
-static inline void update_bird_physics(float y0, float &y_n, float &vy_n, float delta_t,
-                                       bool up_kick, acceleration_function a) noexcept {
+static inline void update_bird_physics(store &s, float y0, float delta_t, bool up_kick,
+                                       acceleration_function a) noexcept {
   const float dt{1.0f / 60.0f};
 
-  static float elapsed{0.0f};
-  elapsed += delta_t;
+  auto &y_n{s.position[slot::bird][1]};
+  auto &vy_n{s.velocity[slot::bird][1]};
+
+  s.bird_elapsed = std::min(s.bird_elapsed + delta_t, max_catch_up_steps * dt);
 
   if (up_kick) {
     vy_n = -300.0f;
   }
 
   //  Velocity Verlet method
-  if (elapsed > dt) {
+  while (s.bird_elapsed > dt) {
     const auto a_n{a(y_n, y0)};
     y_n = y_n + vy_n * dt + 0.5f * a_n * dt * dt;
     const auto a_np1{a(y_n, y0)};
     vy_n = vy_n + 0.5f * (a_n + a_np1) * dt;
-    elapsed -= dt;
+    s.bird_elapsed -= dt;
   }
 }
 
-static inline auto update_bird(const fpb::tdb_t &tdb, fpb::sdb_t &sdb, const glm::vec2 &bird_origin,
-                               const glm::vec2 &bird_bbox,
-                               const glm::vec2 &original_bird_sheet_size, float delta_t,
-                               bool up_kick, acceleration_function a) noexcept -> glm::mat4 {
+// Adds the sprites of the entities in [first, last)
+static inline void draw_entities(const fpb::resources::handles &textures, fpb::sdb_t &sdb,
+                                 const store &s, const layout &l, surge::u32 first,
+                                 surge::u32 last) noexcept {
   using namespace surge::gl_atom;
 
-  static const auto bird_sheet{tdb.find("resources/sheets/bird_red.png").value_or(0)};
-
-  const auto flap_frame_view{update_bird_flap_animation_frame(delta_t)};
-
-  static float y_n{bird_origin[1] - 10.0f};
-  static float vy_n{0};
-  update_bird_physics(bird_origin[1], y_n, vy_n, delta_t, up_kick, a);
+  for (auto i = first; i < last; i++) {
+    const auto &pos{s.position[i]}; // NOLINT
+    const auto &bbox{s.bbox[i]};    // NOLINT
+    const auto depth{s.depth[i]};   // NOLINT
 
-  const glm::vec2 bird_pos{bird_origin[0], y_n};
-  const auto bird_model{sprite_database::place_sprite(bird_pos, bird_bbox, 0.3f)};
+    const auto model{sprite_database::place_sprite(pos, bbox, depth)};
 
-  surge::gl_atom::sprite_database::add_view(sdb, bird_sheet, bird_model, flap_frame_view,
-                                            original_bird_sheet_size);
+    switch (s.sprite_ref[i]) { // NOLINT
 
-  return bird_model;
-}
-
-static inline void update_pipes(const fpb::tdb_t &tdb, fpb::sdb_t &sdb, float delta_t,
-                                const glm::vec2 &pipe_gaps, const glm::vec2 &pipe_bbox,
-                                pipe_queue_t &pipe_queue) noexcept {
-  using namespace surge::gl_atom;
-
-  static const auto pipe_handle{tdb.find("resources/static/pipe-green.png").value_or(0)};
-
-  const float drift_speed{80.0f};
-  const float dt{1.0f / 60.0f};
-
-  static float elapsed{0.0f};
-  elapsed += delta_t;
-
-  for (auto &pipe_down_pos : pipe_queue) {
-    // Place pipe sprites
-    const glm::vec2 pipe_up_pos{pipe_down_pos[0], pipe_down_pos[1] - pipe_gaps[1]};
-
-    const auto pipe_down{sprite_database::place_sprite(pipe_down_pos, pipe_bbox, 0.15f)};
-    const auto pipe_up{
-        glm::translate(glm::rotate(sprite_database::place_sprite(pipe_up_pos, pipe_bbox, 0.15f),
-                                   glm::radians(180.0f), glm::vec3{0.0f, 0.0f, 1.0f}),
-                       glm::vec3{-1.0f, 0.0f, 0.0f})};
+    case sprite::base:
+      sprite_database::add(sdb, textures.base, model);
+      break;
 
-    sprite_database::add(sdb, pipe_handle, pipe_down);
-    sprite_database::add(sdb, pipe_handle, pipe_up);
+    case sprite::pipe: {
+      // The upper pipe is the lower one turned upside down, a gap above it
+      const glm::vec2 pipe_up_pos{pos[0], pos[1] - l.pipe_gaps[1]};
+      const auto pipe_up{
+          glm::translate(glm::rotate(sprite_database::place_sprite(pipe_up_pos, bbox, depth),
+                                     glm::radians(180.0f), glm::vec3{0.0f, 0.0f, 1.0f}),
+                         glm::vec3{-1.0f, 0.0f, 0.0f})};
 
-    // Update pipe position
-    if (elapsed > dt) {
-      pipe_down_pos[0] -= drift_speed * dt;
+      sprite_database::add(sdb, textures.pipe, model);
+      sprite_database::add(sdb, textures.pipe, pipe_up);
+      break;
     }
-  }
 
-  if (elapsed > dt) {
-    elapsed -= dt;
-  }
+    case sprite::bird:
+      sprite_database::add_view(sdb, textures.bird_sheet, model,
+                                bird_frame_views[s.flap_frame], // NOLINT
+                                l.bird_sheet_size);
+      break;
 
-  // Check if leftmost pipe left the screen
-  if ((pipe_queue.front()[0] + pipe_bbox[0]) < 0) {
-    pipe_queue.pop_front();
+    default:
+      break;
+    }
   }
 }
 
@@ -220,73 +202,76 @@ static inline auto rect_collision(const glm::vec2 &rect1_start, const glm::vec2
   return r1x < r2x + r2w && r1x + r1w > r2x && r1y < r2y + r2h && r1y + r1h > r2y;
 }
 
-static inline auto update_collision(const glm::mat4 &bird_model, const glm::vec2 &bird_bbox,
-                                    const glm::vec2 &base_pos, const ::glm::vec2 &pipe_gaps,
-                                    const ::glm::vec2 &pipe_bbox,
-                                    const pipe_queue_t &pipe_queue) noexcept -> bool {
-  using std::fabs;
+static inline auto update_collision(const fpb::collision::masks &masks, const store &s,
+                                    const layout &l) noexcept -> bool {
+  using fpb::collision::overlap;
+
+  const auto &bird_pos{s.position[slot::bird]};
+  const auto &bird_bbox{s.bbox[slot::bird]};
+  const auto &bird_mask{masks.bird_frames[s.flap_frame]}; // NOLINT
 
-  bool collision{false};
+  // Ground collision: True if the lowest opaque row of the current frame reaches the base top. The
+  // frames have a transparent border, so the sprite bottom is not where the bird is.
+  const auto bird_texel_h{bird_bbox[1] / static_cast<float>(bird_mask.height)};
+  const auto bird_bottom_row{masks.bird_bottom_rows[s.flap_frame]}; // NOLINT
+  const auto bird_bottom{bird_pos[1] + static_cast<float>(bird_bottom_row + 1) * bird_texel_h};
+  const auto base_top{l.window_dims[1] - l.base_bbox[1]};
 
-  const glm::vec2 bird_pos{bird_model[3][0], bird_model[3][1]};
+  if (bird_bottom >= base_top) {
+    return true;
+  }
+
+  // Pipe collision: The sprite rects are the broad phase and the masks the narrow phase, which only
+  // runs for the few ticks the bird spends inside a pipe rect
+  for (surge::u32 i = slot::pipe_0; i < slot::pipe_0 + pipe_count; i++) {
+    const auto &pipe_down_pos{s.position[i]}; // NOLINT
+    const auto &pipe_bbox{s.bbox[i]};         // NOLINT
 
-  // Ground collision: True if bird bottom equals base top
-  // To make sure that the very bottom of the bird touches the ground, we need to introduce a 1px
-  // offset. This is probably due to the fact that the sprites have a 1 pixel buffer around then.
-  // This should not be necessary, but nevertheless, it is happening.
-  // TODO: Fix this
-  const auto bird_bottom{bird_pos[1] + bird_bbox[1]};
-  const auto base_top{base_pos[1]};
-  collision |= (bird_bottom > base_top) || ((base_top - bird_bottom) < 1.0e-1f);
+    const glm::vec2 pipe_up_pos{pipe_down_pos[0], pipe_down_pos[1] - l.pipe_gaps[1] - pipe_bbox[1]};
 
-  // Pipe collision: Construct the pipe rects and check bird-pipe for each pipe
-  for (const auto &pipe_down_pos : pipe_queue) {
-    const glm::vec2 pipe_up_pos{pipe_down_pos[0], 0.0f};
-    const glm::vec2 pip_up_bbox{pipe_bbox[0], pipe_down_pos[1] - pipe_gaps[1]};
+    if (rect_collision(bird_pos, bird_bbox, pipe_down_pos, pipe_bbox)
+        && overlap(bird_mask, bird_pos, bird_bbox, masks.pipe_down, pipe_down_pos, pipe_bbox)) {
+      return true;
+    }
 
-    collision |= rect_collision(bird_pos, bird_bbox, pipe_down_pos, pipe_bbox);
-    collision |= rect_collision(bird_pos, bird_bbox, pipe_up_pos, pip_up_bbox);
+    if (rect_collision(bird_pos, bird_bbox, pipe_up_pos, pipe_bbox)
+        && overlap(bird_mask, bird_pos, bird_bbox, masks.pipe_up, pipe_up_pos, pipe_bbox)) {
+      return true;
+    }
   }
 
-  return collision;
+  return false;
 }
 
-static inline void compute_score(const pipe_queue_t &pipe_queue, const glm::vec2 &pipe_bbox,
-                                 const glm::vec2 &bird_origin, surge::u64 &score) noexcept {
+static inline void compute_score(store &s, const layout &l) noexcept {
   // Get the right x value of the leftmost pipe
-  const auto pipe_right_x{pipe_queue.front()[0] + pipe_bbox[0]};
+  const auto leftmost{pipe_slot(s, 0)};
+  const auto pipe_right_x{s.position[leftmost][0] + s.bbox[leftmost][0]};
 
   // Get the bird x
-  const auto bird_x{bird_origin[0]};
+  const auto bird_x{l.bird_origin[0]};
 
   // Bird - pipe distance
   const auto distance{pipe_right_x - bird_x};
 
   // Distance signs
   const auto curr_dist_sign{sign(distance)};
-  static auto prev_dist_sign{curr_dist_sign};
 
   // If there is a + to - sign shift, we score
-  if (curr_dist_sign == -1 && prev_dist_sign == 1) {
-    score += 1;
+  if (curr_dist_sign == -1 && s.prev_dist_sign == 1) {
+    s.score += 1;
   }
 
-  prev_dist_sign = curr_dist_sign;
+  s.prev_dist_sign = curr_dist_sign;
 }
 
-static inline void update_instructions_msg(const fpb::tdb_t &tdb, fpb::sdb_t &sdb,
+static inline void update_instructions_msg(const fpb::resources::handles &textures, fpb::sdb_t &sdb,
                                            const glm::vec2 &window_dims,
                                            const glm::vec2 &bird_origin, const glm::vec2 &bird_bbox,
                                            const glm::vec2 &instructions_1_bbox,
                                            const glm::vec2 &instructions_2_bbox) noexcept {
   using namespace surge::gl_atom;
 
-  static const auto instructions_1_texture{
-      tdb.find("resources/text/instructions_1.png").value_or(0)};
-
-  static const auto instructions_2_texture{
-      tdb.find("resources/text/instructions_2.png").value_or(0)};
-
   const glm::vec2 instructions_1_pos{(window_dims[0] - instructions_1_bbox[0]) / 2.0f, 0.0f};
   const auto instructions_1_model{
       sprite_database::place_sprite(instructions_1_pos, instructions_1_bbox, 0.5f)};
@@ -297,26 +282,15 @@ static inline void update_instructions_msg(const fpb::tdb_t &tdb, fpb::sdb_t &sd
   const auto instructions_2_model{
       sprite_database::place_sprite(instructions_2_pos, instructions_1_bbox, 0.5f)};
 
-  sprite_database::add(sdb, instructions_1_texture, instructions_1_model);
-  sprite_database::add(sdb, instructions_2_texture, instructions_2_model);
+  sprite_database::add(sdb, textures.instructions_1, instructions_1_model);
+  sprite_database::add(sdb, textures.instructions_2, instructions_2_model);
 }
 
-static inline void update_score_msg(const fpb::tdb_t &tdb, fpb::sdb_t &sdb,
+static inline void update_score_msg(const fpb::resources::handles &textures, fpb::sdb_t &sdb,
                                     const glm::vec2 &window_dims, const glm::vec2 &numbers_bbox,
                                     const surge::u64 &score) noexcept {
   using namespace surge::gl_atom;
 
-  static const auto texture_0{tdb.find("resources/numbers/0.png").value_or(0)};
-  static const auto texture_1{tdb.find("resources/numbers/1.png").value_or(0)};
-  static const auto texture_2{tdb.find("resources/numbers/2.png").value_or(0)};
-  static const auto texture_3{tdb.find("resources/numbers/3.png").value_or(0)};
-  static const auto texture_4{tdb.find("resources/numbers/4.png").value_or(0)};
-  static const auto texture_5{tdb.find("resources/numbers/5.png").value_or(0)};
-  static const auto texture_6{tdb.find("resources/numbers/6.png").value_or(0)};
-  static const auto texture_7{tdb.find("resources/numbers/7.png").value_or(0)};
-  static const auto texture_8{tdb.find("resources/numbers/8.png").value_or(0)};
-  static const auto texture_9{tdb.find("resources/numbers/9.png").value_or(0)};
-
   // Score total width
   const auto socre_digits{num_digits(score)};
   const auto score_width{numbers_bbox[1] * static_cast<float>(socre_digits)};
@@ -334,7 +308,7 @@ static inline void update_score_msg(const fpb::tdb_t &tdb, fpb::sdb_t &sdb,
 
   if (local_score == 0) {
     sprite_database::add(
-        sdb, texture_0,
+        sdb, textures.numbers[0],
         sprite_database::place_sprite(glm::vec2{score_cursor, score_y}, numbers_bbox, 0.5f));
     return;
   }
@@ -342,276 +316,260 @@ static inline void update_score_msg(const fpb::tdb_t &tdb, fpb::sdb_t &sdb,
   while (local_score > 0) {
     const auto digit{local_score % 10};
 
-    switch (digit) {
-
-    case 0:
-      sprite_database::add(
-          sdb, texture_0,
-          sprite_database::place_sprite(glm::vec2{score_cursor, score_y}, numbers_bbox, 0.5f));
-      break;
-
-    case 1:
-      sprite_database::add(
-          sdb, texture_1,
-          sprite_database::place_sprite(glm::vec2{score_cursor, score_y}, numbers_bbox, 0.5f));
-      break;
-
-    case 2:
-      sprite_database::add(
-          sdb, texture_2,
-          sprite_database::place_sprite(glm::vec2{score_cursor, score_y}, numbers_bbox, 0.5f));
-      break;
-
-    case 3:
-      sprite_database::add(
-          sdb, texture_3,
-          sprite_database::place_sprite(glm::vec2{score_cursor, score_y}, numbers_bbox, 0.5f));
-      break;
-
-    case 4:
-      sprite_database::add(
-          sdb, texture_4,
-          sprite_database::place_sprite(glm::vec2{score_cursor, score_y}, numbers_bbox, 0.5f));
-      break;
-
-    case 5:
-      sprite_database::add(
-          sdb, texture_5,
-          sprite_database::place_sprite(glm::vec2{score_cursor, score_y}, numbers_bbox, 0.5f));
-      break;
-
-    case 6:
-      sprite_database::add(
-          sdb, texture_6,
-          sprite_database::place_sprite(glm::vec2{score_cursor, score_y}, numbers_bbox, 0.5f));
-      break;
-
-    case 7:
-      sprite_database::add(
-          sdb, texture_7,
-          sprite_database::place_sprite(glm::vec2{score_cursor, score_y}, numbers_bbox, 0.5f));
-      break;
-
-    case 8:
-      sprite_database::add(
-          sdb, texture_8,
-          sprite_database::place_sprite(glm::vec2{score_cursor, score_y}, numbers_bbox, 0.5f));
-      break;
-
-    case 9:
-      sprite_database::add(
-          sdb, texture_9,
-          sprite_database::place_sprite(glm::vec2{score_cursor, score_y}, numbers_bbox, 0.5f));
-      break;
-
-    default:
-      break;
-    }
+    sprite_database::add(
+        sdb, textures.numbers[digit], // NOLINT
+        sprite_database::place_sprite(glm::vec2{score_cursor, score_y}, numbers_bbox, 0.5f));
 
     local_score /= 10;
     score_cursor -= numbers_bbox[0];
   }
 }
 
-static inline void update_game_over_msg(const fpb::tdb_t &tdb, fpb::sdb_t &sdb,
+static inline void update_game_over_msg(const fpb::resources::handles &textures, fpb::sdb_t &sdb,
                                         const glm::vec2 &window_dims,
                                         const glm::vec2 &game_over_bbox) noexcept {
   using namespace surge::gl_atom;
 
-  static const auto game_over_texture{tdb.find("resources/text/gameover.png").value_or(0)};
-
   const auto game_over_pos{(window_dims - game_over_bbox) / 2.0f};
   const auto game_over_model{sprite_database::place_sprite(game_over_pos, game_over_bbox, 0.5f)};
 
-  sprite_database::add(sdb, game_over_texture, game_over_model);
+  sprite_database::add(sdb, textures.game_over, game_over_model);
 }
 
-static inline void update_state_prepare(const fpb::tdb_t &tdb, fpb::sdb_t &sdb,
-                                        const glm::vec2 &window_dims, const glm::vec2 &base_bbox,
-                                        const glm::vec2 &bird_origin, const glm::vec2 &bird_bbox,
-                                        const glm::vec2 &original_bird_sheet_size,
-                                        const glm::vec2 &instructions_1_bbox,
-                                        const glm::vec2 &instructions_2_bbox,
-                                        float delta_t) noexcept {
+static inline void update_state_prepare(const fpb::resources::handles &textures, fpb::sdb_t &sdb,
+                                        store &s, const layout &l, float delta_t) noexcept {
   // Database reset
   surge::gl_atom::sprite_database::begin_add(sdb);
 
   // Background
-  update_background(tdb, sdb, window_dims);
+  update_background(textures, sdb, l.window_dims);
 
   // Rolling base
-  update_rolling_base(tdb, sdb, window_dims, base_bbox, delta_t);
+  update_scroll(s, slot::base_l, slot::pipe_0, delta_t);
+  update_rolling_base(s);
 
   // Bird
-  update_bird(tdb, sdb, bird_origin, bird_bbox, original_bird_sheet_size, delta_t, false,
-              harmonic_oscillator);
+  update_bird_flap_animation_frame(s, delta_t);
+  update_bird_physics(s, l.bird_origin[1], delta_t, false, harmonic_oscillator);
+
+  draw_entities(textures, sdb, s, l, slot::base_l, slot::pipe_0);
+  draw_entities(textures, sdb, s, l, slot::bird, slot::count);
 
   // Instructions
-  update_instructions_msg(tdb, sdb, window_dims, bird_origin, bird_bbox, instructions_1_bbox,
-                          instructions_2_bbox);
+  update_instructions_msg(textures, sdb, l.window_dims, l.bird_origin, l.bird_bbox,
+                          l.instructions_1_bbox, l.instructions_2_bbox);
 }
 
-static inline auto update_state_play(window_t w, const fpb::tdb_t &tdb, fpb::sdb_t &sdb,
-                                     const glm::vec2 &window_dims, const glm::vec2 &base_bbox,
-                                     const glm::vec2 &bird_origin, const glm::vec2 &bird_bbox,
-                                     const glm::vec2 &original_bird_sheet_size,
-                                     const glm::vec2 &pipe_gaps, const glm::vec2 &pipe_bbox,
-                                     pipe_queue_t &pipe_queue, const glm::vec2 &numbers_bbox,
-                                     surge::u64 &score, float delta_t) noexcept -> bool {
+static inline auto update_state_play(bool button_down, const fpb::resources::handles &textures,
+                                     const fpb::collision::masks &masks, fpb::sdb_t &sdb,
+                                     store &s, const layout &l, float delta_t) noexcept -> bool {
   // Database reset
   surge::gl_atom::sprite_database::begin_add(sdb);
 
   // Background
-  update_background(tdb, sdb, window_dims);
+  update_background(textures, sdb, l.window_dims);
 
-  // Rolling base
-  const glm::vec2 &base_pos{0.0, window_dims[1] - base_bbox[1]};
-  update_rolling_base(tdb, sdb, window_dims, base_bbox, delta_t);
+  // Rolling base and pipes
+  update_scroll(s, slot::base_l, slot::bird, delta_t);
+  update_rolling_base(s);
+  update_pipes(s, l);
 
-  // Pipes
-  update_pipes(tdb, sdb, delta_t, pipe_gaps, pipe_bbox, pipe_queue);
+  // Bird. We enter this state on a mouse press
+  const auto up_kick{button_down && s.old_button_down == 0};
 
-  // Bird
-  static auto old_click_state{GLFW_RELEASE}; // We enter this state on a mouse press
-  const auto current_click_state{surge::window::get_mouse_button(w, GLFW_MOUSE_BUTTON_LEFT)};
-  const auto up_kick{current_click_state == GLFW_PRESS && old_click_state == GLFW_RELEASE};
+  update_bird_flap_animation_frame(s, delta_t);
+  update_bird_physics(s, l.bird_origin[1], delta_t, up_kick, gravity);
 
-  const auto bird_model{update_bird(tdb, sdb, bird_origin, bird_bbox, original_bird_sheet_size,
-                                    delta_t, up_kick, gravity)};
+  draw_entities(textures, sdb, s, l, slot::base_l, slot::count);
 
   // Update collisions
-  const auto collided{
-      update_collision(bird_model, bird_bbox, base_pos, pipe_gaps, pipe_bbox, pipe_queue)};
+  const auto collided{update_collision(masks, s, l)};
+  s.collided = collided ? 1 : 0;
 
   // Update score
   if (!collided) {
-    compute_score(pipe_queue, pipe_bbox, bird_origin, score);
+    compute_score(s, l);
   }
 
-  update_score_msg(tdb, sdb, window_dims, numbers_bbox, score);
+  update_score_msg(textures, sdb, l.window_dims, l.numbers_bbox, s.score);
 
   // Refresh click cache
-  old_click_state = surge::window::get_mouse_button(w, GLFW_MOUSE_BUTTON_LEFT);
+  s.old_button_down = button_down ? 1 : 0;
 
   return collided;
 }
 
-static inline void update_score(const fpb::tdb_t &tdb, fpb::sdb_t &sdb,
-                                const glm::vec2 &window_dims, const glm::vec2 &base_bbox,
-                                const glm::vec2 &bird_origin, const glm::vec2 &bird_bbox,
-                                const glm::vec2 &original_bird_sheet_size,
-                                const glm::vec2 &pipe_gaps, const glm::vec2 &pipe_bbox,
-                                pipe_queue_t &pipe_queue, const glm::vec2 &numbers_bbox,
-                                const glm::vec2 &game_over_bbox, surge::u64 &score) {
-  const float delta_t{0.0f};
-
-  surge::gl_atom::sprite_database::begin_add(sdb);
-
-  update_background(tdb, sdb, window_dims);
-  update_rolling_base(tdb, sdb, window_dims, base_bbox, delta_t);
-  update_pipes(tdb, sdb, delta_t, pipe_gaps, pipe_bbox, pipe_queue);
-  update_bird(tdb, sdb, bird_origin, bird_bbox, original_bird_sheet_size, delta_t, false, gravity);
-  update_score_msg(tdb, sdb, window_dims, numbers_bbox, score);
-  update_game_over_msg(tdb, sdb, window_dims, game_over_bbox);
+// Frames of screens that move rebuild every sprite, so nothing they built can be reused later
+static inline void begin_animated_frame(fpb::state_machine::scene &sc) noexcept {
+  sc.built_state = fpb::state_machine::state::no_state;
+  sc.rebuilds_left = 0;
+  sc.idle = false;
 }
 
-void fpb::state_machine::state_update(window_t w, const fpb::tdb_t &tdb, fpb::sdb_t &sdb,
-                                      const state &state_a, state &state_b,
-                                      double delta_t) noexcept {
-  using namespace surge;
-  using namespace fpb::state_machine;
-
-  // Float conversions
-  const auto fdelta_t{static_cast<float>(delta_t)};
-
-  // Original sizes
-  const glm::vec2 original_window_size{288.0f, 512.0f};
-  const glm::vec2 original_bird_bbox{34.0f, 24.0f};
-  const glm::vec2 original_base_bbox{288.0f, 112.0f};
-  const glm::vec2 original_pipe_bbox{52.0f, 32.0f};
-
-  const glm::vec2 original_bird_sheet_size{141.0f, 26.0f};
-
-  const glm::vec2 original_instructions_1_size{184.0f, 152.0f};
-  const glm::vec2 original_instructions_2_size{114.0f, 60.0f};
-  const glm::vec2 original_game_over_size{192.0f, 42.0f};
-
-  const glm::vec2 original_numnbers_size{24.0f, 36.0f};
+// Frames of static screens only rebuild their sprites while the scene is dirty. Returns true if
+// they have to.
+static inline auto begin_static_frame(fpb::state_machine::scene &sc,
+                                      fpb::state_machine::state state,
+                                      const fpb::resources::handles &textures,
+                                      const glm::vec2 &window_dims, surge::u64 score) noexcept
+    -> bool {
+  sc.idle = true;
+
+  const auto changed{sc.built_state != state || sc.built_textures != textures
+                     || sc.built_dims != window_dims || sc.built_score != score};
+
+  if (changed) {
+    sc.built_state = state;
+    sc.built_textures = textures;
+    sc.built_dims = window_dims;
+    sc.built_score = score;
+
+    // Whichever buffer the database draws next, the following updates refill all of them
+    sc.rebuilds_left = fpb::sprite_buffer_redundancy;
+  }
 
-  const auto window_dims{window::get_dims(w)};
-  const auto scale_factor{window_dims / original_window_size};
+  if (sc.rebuilds_left == 0) {
+    return false;
+  }
 
-  // Base sizes
-  const auto base_bbox{original_base_bbox * scale_factor};
+  sc.rebuilds_left--;
+  return true;
+}
 
-  // Bird sizes
-  const auto bird_bbox{original_bird_bbox * scale_factor};
-  const glm::vec2 bird_origin{window_dims[0] / 3.0f - bird_bbox[0] / 2.0f,
-                              window_dims[1] / 2.0f - bird_bbox[1] / 2.0f};
+static inline void update_score(const fpb::resources::handles &textures, fpb::sdb_t &sdb,
+                                const store &s, const layout &l) noexcept {
+  surge::gl_atom::sprite_database::begin_add(sdb);
 
-  // Pipe sizes
-  const glm::vec2 pipe_gaps{window_dims[0] / 2.0f, 150.0f};
-  const glm::vec2 pipe_bbox{original_pipe_bbox[0] * scale_factor[0], window_dims[1]};
+  update_background(textures, sdb, l.window_dims);
+  draw_entities(textures, sdb, s, l, slot::base_l, slot::count);
+  update_score_msg(textures, sdb, l.window_dims, l.numbers_bbox, s.score);
+  update_game_over_msg(textures, sdb, l.window_dims, l.game_over_bbox);
+}
 
-  // Instructions size
-  const auto instructions_1_bbox{original_instructions_1_size * scale_factor};
-  const glm::vec2 instructions_2_bbox{original_instructions_2_size * scale_factor};
+// Practice runs that crash rewind this much play at this many times real time
+static constexpr float rewind_seconds{2.0f};
+static constexpr float rewind_speed{3.0f};
+
+static inline void update_state_rewinding(const fpb::resources::handles &textures,
+                                          fpb::sdb_t &sdb, store &s, fpb::rewind::history &h,
+                                          fpb::state_machine::scene &sc, const layout &l,
+                                          float delta_t) noexcept {
+  // Walk back through the history, then hold on the tick play resumes from
+  if (h.remaining > 0.0f) {
+    auto budget{delta_t * rewind_speed};
+
+    while (h.remaining > 0.0f && budget > 0.0f) {
+      const auto undone{fpb::rewind::step_back(h)};
+      if (undone == 0.0f) {
+        h.remaining = 0.0f;
+        break;
+      }
+
+      h.remaining -= undone;
+      budget -= undone;
+    }
 
-  // Game over screen size
-  const auto game_over_bbox{original_game_over_size * scale_factor};
+    fpb::rewind::restore(h, s);
+    begin_animated_frame(sc);
+  } else if (!begin_static_frame(sc, fpb::state_machine::state::rewinding, textures,
+                                 l.window_dims, s.score)) {
+    return;
+  }
 
-  // Score numbers size
-  const auto numbers_bbox{original_numnbers_size * scale_factor};
+  surge::gl_atom::sprite_database::begin_add(sdb);
 
-  // Allowed pipe y range
-  const float allowed_pipe_area_fraction{(window_dims[1] - base_bbox[1]) / 4.0f};
-  std::uniform_real_distribution<float> pipe_y_range{
-      allowed_pipe_area_fraction, window_dims[1] - base_bbox[1] - allowed_pipe_area_fraction};
+  update_background(textures, sdb, l.window_dims);
+  draw_entities(textures, sdb, s, l, slot::base_l, slot::count);
+  update_score_msg(textures, sdb, l.window_dims, l.numbers_bbox, s.score);
+}
 
-  // Initialize pipe position queue
-  static std::minstd_rand engine{std::random_device{}()};
+void fpb::state_machine::state_update(window_t w, const fpb::resources::handles &textures,
+                                      const collision::masks &masks, fpb::sdb_t &sdb,
+                                      entities::store &game, rewind::history &history,
+                                      scene &sc, const state &state_a, state &state_b,
+                                      bool button_down, bool textures_ready,
+                                      double delta_t) noexcept {
+  using namespace surge;
+  using namespace fpb::state_machine;
 
-  static pipe_queue_t pipe_queue{
-      {glm::vec2{window_dims[0], pipe_y_range(engine)},
-       glm::vec2{window_dims[0] + window_dims[0] / 2.0f, pipe_y_range(engine)},
-       glm::vec2{window_dims[0] + 2.0f * window_dims[0] / 2.0f, pipe_y_range(engine)},
-       glm::vec2{window_dims[0] + 3.0f * window_dims[0] / 2.0f, pipe_y_range(engine)}}};
+  // Float conversions
+  const auto fdelta_t{static_cast<float>(delta_t)};
 
-  // Keep pipe number constant
-  if (pipe_queue.size() != 4) {
-    const auto &last_pipe{pipe_queue.back()};
-    const glm::vec2 new_pipe{last_pipe[0] + window_dims[0] / 2.0f, pipe_y_range(engine)};
-    pipe_queue.emplace_back(new_pipe);
-  }
+  const auto l{make_layout(window::get_dims(w))};
 
-  // Game score
-  static surge::u64 score{0};
+  const auto new_click{button_down && game.old_button_down == 0};
 
   // State switch
   switch (state_a) {
 
   case state::prepare:
-    update_state_prepare(tdb, sdb, window_dims, base_bbox, bird_origin, bird_bbox,
-                         original_bird_sheet_size, instructions_1_bbox, instructions_2_bbox,
-                         fdelta_t);
+    begin_animated_frame(sc);
+    update_state_prepare(textures, sdb, game, l, fdelta_t);
 
-    if (window::get_mouse_button(w, GLFW_MOUSE_BUTTON_LEFT) == GLFW_PRESS) {
+    // Play needs the streamed gameplay textures to be resident. The click that starts the game is
+    // also its first flap, so it stays out of the click cache.
+    if (new_click && textures_ready) {
+      rewind::clear(history);
       state_b = state::play;
+    } else {
+      game.old_button_down = button_down ? 1 : 0;
     }
     break;
 
-  case state::play:
-    if (update_state_play(w, tdb, sdb, window_dims, base_bbox, bird_origin, bird_bbox,
-                          original_bird_sheet_size, pipe_gaps, pipe_bbox, pipe_queue, numbers_bbox,
-                          score, fdelta_t)) {
+  case state::play: {
+    begin_animated_frame(sc);
+    const auto collided{update_state_play(button_down, textures, masks, sdb, game, l, fdelta_t)};
+
+    if (history.enabled) {
+      rewind::capture(history, game, fdelta_t);
+    }
+
+    // Practice runs rewind instead of ending
+    if (collided) {
       gl_atom::sprite_database::wait_idle(sdb);
+      state_b = history.enabled && rewind::begin(history, rewind_seconds) ? state::rewinding
+                                                                           : state::score;
+    }
+    break;
+  }
+
+  case state::rewinding:
+    // Leaving practice mode ends the run where it crashed. A history that is empty has nothing to
+    // rewind or resume from, so the run ends where the rewind got to.
+    if (!history.enabled || rewind::empty(history)) {
+      if (rewind::begin(history, 0.0f)) {
+        rewind::restore(history, game);
+      }
       state_b = state::score;
+      break;
+    }
+
+    update_state_rewinding(textures, sdb, game, history, sc, l, fdelta_t);
+
+    // A new click resumes play from the rewound tick, and is also its first flap
+    if (new_click) {
+      rewind::resume(history);
+      game.old_button_down = 0;
+      state_b = state::play;
+    } else {
+      game.old_button_down = button_down ? 1 : 0;
     }
     break;
 
   case state::score:
-    update_score(tdb, sdb, window_dims, base_bbox, bird_origin, bird_bbox, original_bird_sheet_size,
-                 pipe_gaps, pipe_bbox, pipe_queue, numbers_bbox, game_over_bbox, score);
+    // The score screen does not move, so it is only rebuilt when it is entered, the theme changes
+    // or the window is resized
+    if (begin_static_frame(sc, state::score, textures, l.window_dims, game.score)) {
+      update_score(textures, sdb, game, l);
+    }
+
+    // A new click starts over
+    if (new_click) {
+      entities::reset(game, l);
+      state_b = state::prepare;
+    }
+
+    game.old_button_down = button_down ? 1 : 0;
     break;
 
   default:
@@ -0,0 +1,168 @@
+#include "telemetry.hpp"
+
+#include <cerrno>
+#include <csignal>
+#include <fcntl.h>
+#include <new>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static auto process_alive(std::int32_t pid) noexcept -> bool {
+  // EPERM means the process exists but belongs to someone else
+  return pid > 0 && (kill(pid, 0) == 0 || errno == EPERM);
+}
+
+auto fpb::telemetry::open_writer(const char *name) noexcept -> std::optional<writer> {
+  // The name is only created, never opened, so two games can not reset each other's ring
+  auto fd{shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0644)};
+
+  if (fd < 0 && errno == EEXIST) {
+    // Rings that can not be read were left by an incompatible or crashed writer
+    if (auto r{open_reader(name)}) {
+      const auto alive{writer_alive(*r)};
+      close_reader(*r);
+
+      if (alive) {
+        return {};
+      }
+    }
+
+    shm_unlink(name);
+    fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0644);
+  }
+
+  if (fd < 0) {
+    return {};
+  }
+
+  struct stat st {};
+  if (fstat(fd, &st) != 0 || ftruncate(fd, sizeof(ring)) != 0) {
+    close(fd);
+    shm_unlink(name);
+    return {};
+  }
+
+  auto mem{mmap(nullptr, sizeof(ring), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)};
+  close(fd);
+
+  if (mem == MAP_FAILED) { // NOLINT
+    shm_unlink(name);
+    return {};
+  }
+
+  auto shm{new (mem) ring{}};
+  shm->version = version;
+  shm->capacity = ring_capacity;
+  shm->record_size = sizeof(record);
+  shm->writer_pid.store(getpid(), std::memory_order_relaxed);
+  shm->head.store(0, std::memory_order_relaxed);
+
+  // Readers reject the ring until the magic is in place
+  std::atomic_thread_fence(std::memory_order_release);
+  shm->magic = magic;
+
+  return writer{shm, 0, static_cast<std::uint64_t>(st.st_ino)};
+}
+
+void fpb::telemetry::close_writer(writer &w, const char *name) noexcept {
+  if (w.shm == nullptr) {
+    return;
+  }
+
+  w.shm->writer_pid.store(0, std::memory_order_release);
+
+  // The ring is still mapped here, so its inode can not have been reused by another one
+  const auto fd{shm_open(name, O_RDONLY, 0)};
+  if (fd >= 0) {
+    struct stat st {};
+    if (fstat(fd, &st) == 0 && static_cast<std::uint64_t>(st.st_ino) == w.inode) {
+      shm_unlink(name);
+    }
+    close(fd);
+  }
+
+  munmap(w.shm, sizeof(ring));
+  w.shm = nullptr;
+}
+
+auto fpb::telemetry::open_reader(const char *name) noexcept -> std::optional<reader> {
+  const auto fd{shm_open(name, O_RDONLY, 0)};
+  if (fd < 0) {
+    return {};
+  }
+
+  struct stat st {};
+  if (fstat(fd, &st) != 0 || static_cast<std::size_t>(st.st_size) < sizeof(ring)) {
+    close(fd);
+    return {};
+  }
+
+  auto mem{mmap(nullptr, sizeof(ring), PROT_READ, MAP_SHARED, fd, 0)};
+  close(fd);
+
+  if (mem == MAP_FAILED) { // NOLINT
+    return {};
+  }
+
+  const auto shm{static_cast<const ring *>(mem)};
+
+  if (shm->magic != magic || shm->version != version || shm->capacity != ring_capacity
+      || shm->record_size != sizeof(record)) {
+    munmap(mem, sizeof(ring));
+    return {};
+  }
+
+  // Start at the live edge of the stream
+  return reader{shm, shm->head.load(std::memory_order_acquire)};
+}
+
+void fpb::telemetry::close_reader(reader &r) noexcept {
+  if (r.shm == nullptr) {
+    return;
+  }
+
+  munmap(const_cast<ring *>(r.shm), sizeof(ring)); // NOLINT
+  r.shm = nullptr;
+}
+
+auto fpb::telemetry::writer_alive(const reader &r) noexcept -> bool {
+  return process_alive(r.shm->writer_pid.load(std::memory_order_acquire));
+}
+
+auto fpb::telemetry::read(reader &r, record &out, std::uint64_t &lost) noexcept -> bool {
+  while (true) {
+    const auto head{r.shm->head.load(std::memory_order_acquire)};
+
+    if (r.next == head) {
+      return false;
+    }
+
+    // The slot of record head - capacity may be getting overwritten right now, so the oldest safe
+    // record is the one after it
+    if (head - r.next >= ring_capacity) {
+      const auto oldest{head - ring_capacity + 1};
+      lost += oldest - r.next;
+      r.next = oldest;
+    }
+
+    const auto &s{r.shm->slots[r.next & (ring_capacity - 1)]}; // NOLINT
+    const auto expected{2 * r.next + 2};
+
+    const auto sequence_before{s.sequence.load(std::memory_order_acquire)};
+    if (sequence_before != expected) {
+      continue;
+    }
+
+    std::memcpy(&out, &s.data, sizeof(record));
+    std::atomic_thread_fence(std::memory_order_acquire);
+
+    const auto sequence_after{s.sequence.load(std::memory_order_relaxed)};
+    if (sequence_after != expected) {
+      continue;
+    }
+
+    r.next++;
+    return true;
+  }
+}
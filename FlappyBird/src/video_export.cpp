@@ -0,0 +1,371 @@
+#include "flappy_bird.hpp"
+
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Number of frames in flight between the GPU and the encoder. Readbacks are only mapped once the
+// ring wraps around, by which time the copy has long finished and mapping does not stall.
+static constexpr surge::usize readback_ring_size{4};
+
+// Upper bound on frames waiting to be encoded. The GL thread blocks when the encoders fall behind.
+static constexpr surge::usize max_queued_frames{16};
+
+struct frame_job {
+  surge::u64 index{0};
+  surge::u64 copies{0};
+  surge::vector<surge::u8> pixels{};
+};
+
+struct fpb::video_export::exporter {
+  // Offscreen target
+  GLuint fbo{0};
+  GLuint color{0};
+  GLuint depth{0};
+  GLsizei width{0};
+  GLsizei height{0};
+
+  // Asynchronous readback ring
+  std::array<GLuint, readback_ring_size> pbos{};
+  std::array<GLsync, readback_ring_size> fences{};
+  std::array<surge::u64, readback_ring_size> pbo_frames{};
+  std::array<surge::u64, readback_ring_size> pbo_copies{};
+  surge::u64 readbacks_issued{0};
+  surge::u64 frames_issued{0};
+
+  // Output clock
+  double clock{0.0};
+  surge::u64 frames_due{0};
+
+  // Encoder pool
+  bool raw_video{false};
+  std::string output{};
+
+  std::mutex mutex{};
+  std::condition_variable jobs_available{};
+  std::condition_variable space_available{};
+  surge::deque<frame_job> jobs{};
+  surge::vector<surge::vector<surge::u8>> free_buffers{};
+  surge::u64 frames_written{0};
+  surge::u64 frames_failed{0};
+  bool stop{false};
+  surge::vector<std::thread> workers{};
+
+  std::chrono::steady_clock::time_point start{};
+};
+
+static inline auto frame_bytes(const fpb::video_export::exporter &e) noexcept -> surge::usize {
+  return static_cast<surge::usize>(e.width) * static_cast<surge::usize>(e.height) * 4;
+}
+
+// Converts bottom-up RGBA readbacks to top-down RGB
+static void to_rgb(const fpb::video_export::exporter &e, const surge::vector<surge::u8> &rgba,
+                   surge::vector<surge::u8> &rgb) noexcept {
+  const auto w{static_cast<surge::usize>(e.width)};
+  const auto h{static_cast<surge::usize>(e.height)};
+
+  rgb.resize(w * h * 3);
+
+  for (surge::usize y = 0; y < h; y++) {
+    const auto src_row{rgba.data() + (h - 1 - y) * w * 4};
+    auto dst_row{rgb.data() + y * w * 3};
+
+    for (surge::usize x = 0; x < w; x++) {
+      dst_row[3 * x + 0] = src_row[4 * x + 0];
+      dst_row[3 * x + 1] = src_row[4 * x + 1];
+      dst_row[3 * x + 2] = src_row[4 * x + 2];
+    }
+  }
+}
+
+// Only the first failed write is logged, a full disk fails every frame after it
+static void write_failed(fpb::video_export::exporter &e, const std::string &file,
+                         surge::u64 frames) noexcept {
+  std::lock_guard lock{e.mutex};
+
+  if (e.frames_failed == 0) {
+    log_error("Unable to write exported frames to {}", file);
+  }
+
+  e.frames_failed += frames;
+}
+
+static void encoder_worker(fpb::video_export::exporter &e) noexcept {
+  surge::vector<surge::u8> rgb{};
+  std::fstream raw_file{};
+
+  if (e.raw_video) {
+    raw_file.open(e.output, std::ios::in | std::ios::out | std::ios::binary);
+  }
+
+  while (true) {
+    frame_job job{};
+
+    {
+      std::unique_lock lock{e.mutex};
+      e.jobs_available.wait(lock, [&] { return e.stop || !e.jobs.empty(); });
+
+      if (e.jobs.empty()) {
+        return;
+      }
+
+      job = std::move(e.jobs.front());
+      e.jobs.pop_front();
+    }
+
+    to_rgb(e, job.pixels, rgb);
+
+    const auto rgb_size{static_cast<std::streamsize>(rgb.size())};
+    const auto rgb_data{reinterpret_cast<const char *>(rgb.data())}; // NOLINT
+
+    surge::u64 written{0};
+
+    if (e.raw_video) {
+      // Frames finish out of order across workers, so each one lands at its own offset. Flushing
+      // makes a full disk show up on the frame that hit it.
+      raw_file.seekp(static_cast<std::streamoff>(job.index) * rgb_size);
+
+      for (surge::u64 i = 0; i < job.copies && raw_file.write(rgb_data, rgb_size).flush(); i++) {
+        written++;
+      }
+
+      if (written != job.copies) {
+        write_failed(e, e.output, job.copies - written);
+        raw_file.clear();
+      }
+    } else {
+      for (auto index = job.index; index < job.index + job.copies; index++) {
+        std::array<char, 32> file_name{};
+        std::snprintf(file_name.data(), file_name.size(), "frame_%06llu.ppm",
+                      static_cast<unsigned long long>(index));
+
+        const auto path{std::filesystem::path{e.output} / file_name.data()};
+
+        std::ofstream ppm_file{path, std::ios::binary};
+        ppm_file << "P6\n" << e.width << " " << e.height << "\n255\n";
+        ppm_file.write(rgb_data, rgb_size);
+        ppm_file.close();
+
+        if (!ppm_file) {
+          write_failed(e, path.string(), 1);
+          continue;
+        }
+
+        written++;
+      }
+    }
+
+    {
+      std::lock_guard lock{e.mutex};
+      e.free_buffers.push_back(std::move(job.pixels));
+      e.frames_written += written;
+    }
+
+    e.space_available.notify_one();
+  }
+}
+
+// Maps a finished readback and hands a copy of it to the encoders
+static void collect(fpb::video_export::exporter &e, surge::usize slot) noexcept {
+  glClientWaitSync(e.fences[slot], GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED); // NOLINT
+  glDeleteSync(e.fences[slot]);                                                      // NOLINT
+  e.fences[slot] = nullptr;                                                          // NOLINT
+
+  frame_job job{};
+  job.index = e.pbo_frames[slot];  // NOLINT
+  job.copies = e.pbo_copies[slot]; // NOLINT
+
+  {
+    std::unique_lock lock{e.mutex};
+    e.space_available.wait(lock, [&] { return e.jobs.size() < max_queued_frames; });
+
+    if (!e.free_buffers.empty()) {
+      job.pixels = std::move(e.free_buffers.back());
+      e.free_buffers.pop_back();
+    }
+  }
+
+  const auto size{frame_bytes(e)};
+  job.pixels.resize(size);
+
+  const auto mapped{glMapNamedBufferRange(e.pbos[slot], 0, static_cast<GLsizeiptr>(size), // NOLINT
+                                          GL_MAP_READ_BIT)};
+  std::memcpy(job.pixels.data(), mapped, size);
+  glUnmapNamedBuffer(e.pbos[slot]); // NOLINT
+
+  {
+    std::lock_guard lock{e.mutex};
+    e.jobs.push_back(std::move(job));
+  }
+
+  e.jobs_available.notify_one();
+}
+
+auto fpb::video_export::create(window_t w, const char *output) noexcept -> exporter * {
+  const auto dims{surge::window::get_dims(w)};
+
+  auto e{new exporter{}};
+  e->width = static_cast<GLsizei>(dims[0]);
+  e->height = static_cast<GLsizei>(dims[1]);
+  e->output = output;
+  e->raw_video = std::filesystem::path{output}.extension() == ".rgb";
+
+  // Output
+  std::error_code ec{};
+  if (e->raw_video) {
+    const std::ofstream raw_file{e->output, std::ios::binary | std::ios::trunc};
+
+    if (!raw_file.is_open()) {
+      log_error("Unable to create export file {}", output);
+      delete e;
+      return nullptr;
+    }
+  } else {
+    std::filesystem::create_directories(e->output, ec);
+  }
+
+  if (ec) {
+    log_error("Unable to create export directory {}: {}", output, ec.message());
+    delete e;
+    return nullptr;
+  }
+
+  // Offscreen framebuffer
+  glCreateFramebuffers(1, &e->fbo);
+
+  glCreateRenderbuffers(1, &e->color);
+  glNamedRenderbufferStorage(e->color, GL_RGBA8, e->width, e->height);
+  glNamedFramebufferRenderbuffer(e->fbo, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, e->color);
+
+  glCreateRenderbuffers(1, &e->depth);
+  glNamedRenderbufferStorage(e->depth, GL_DEPTH_COMPONENT24, e->width, e->height);
+  glNamedFramebufferRenderbuffer(e->fbo, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, e->depth);
+
+  if (glCheckNamedFramebufferStatus(e->fbo, GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+    log_error("Export framebuffer is incomplete");
+    destroy(e);
+    return nullptr;
+  }
+
+  // Readback ring
+  glCreateBuffers(static_cast<GLsizei>(readback_ring_size), e->pbos.data());
+  for (const auto pbo : e->pbos) {
+    glNamedBufferStorage(pbo, static_cast<GLsizeiptr>(frame_bytes(*e)), nullptr,
+                         GL_MAP_READ_BIT | GL_CLIENT_STORAGE_BIT);
+  }
+
+  // Encoders. One core is left for the GL thread
+  const auto cores{std::thread::hardware_concurrency()};
+  const auto worker_count{cores > 2 ? cores - 1 : 1};
+
+  for (surge::u32 i = 0; i < worker_count; i++) {
+    e->workers.emplace_back(encoder_worker, std::ref(*e));
+  }
+
+  log_info("Exporting {}x{} frames to {} with {} encoder threads", e->width, e->height, output,
+           worker_count);
+
+  e->start = std::chrono::steady_clock::now();
+  return e;
+}
+
+void fpb::video_export::advance(exporter *e, double dt) noexcept {
+  e->clock += dt;
+
+  // Output frame n is due once the clock is within half a frame of n / frame_rate
+  const auto frames_total{static_cast<surge::u64>(std::floor(e->clock * frame_rate + 0.5))};
+  e->frames_due = frames_total > e->frames_issued ? frames_total - e->frames_issued : 0;
+}
+
+void fpb::video_export::begin_frame(exporter *e) noexcept {
+  // Updates shorter than an output frame are not exported
+  if (e->frames_due == 0) {
+    return;
+  }
+
+  const std::array<GLfloat, 4> clear_color{0.0f, 0.0f, 0.0f, 1.0f};
+  const GLfloat clear_depth{1.0f};
+
+  glBindFramebuffer(GL_FRAMEBUFFER, e->fbo);
+  glClearNamedFramebufferfv(e->fbo, GL_COLOR, 0, clear_color.data());
+  glClearNamedFramebufferfv(e->fbo, GL_DEPTH, 0, &clear_depth);
+}
+
+void fpb::video_export::end_frame(exporter *e) noexcept {
+  if (e->frames_due == 0) {
+    return;
+  }
+
+  const auto slot{e->readbacks_issued % readback_ring_size};
+
+  // The ring wrapped around, so the readback issued ring_size frames ago has to go first
+  if (e->fences[slot] != nullptr) { // NOLINT
+    collect(*e, slot);
+  }
+
+  glNamedFramebufferReadBuffer(e->fbo, GL_COLOR_ATTACHMENT0);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, e->pbos[slot]); // NOLINT
+  glReadPixels(0, 0, e->width, e->height, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+  e->fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0); // NOLINT
+  e->pbo_frames[slot] = e->frames_issued;                          // NOLINT
+  e->pbo_copies[slot] = e->frames_due;                             // NOLINT
+
+  // Updates longer than an output frame hold their frame for as long as they last
+  e->frames_issued += e->frames_due;
+  e->frames_due = 0;
+  e->readbacks_issued++;
+
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void fpb::video_export::destroy(exporter *e) noexcept {
+  if (e == nullptr) {
+    return;
+  }
+
+  // Drain the readback ring in issue order
+  for (surge::usize i = 0; i < readback_ring_size; i++) {
+    const auto slot{(e->readbacks_issued + i) % readback_ring_size};
+    if (e->fences[slot] != nullptr) { // NOLINT
+      collect(*e, slot);
+    }
+  }
+
+  {
+    std::lock_guard lock{e->mutex};
+    e->stop = true;
+  }
+
+  e->jobs_available.notify_all();
+
+  for (auto &worker : e->workers) {
+    worker.join();
+  }
+
+  const auto elapsed{std::chrono::duration<double>(std::chrono::steady_clock::now() - e->start)};
+
+  if (e->frames_written != 0) {
+    log_info("Exported {} frames in {:.2f} s ({:.1f} frames/s)", e->frames_written,
+             elapsed.count(), static_cast<double>(e->frames_written) / elapsed.count());
+  }
+
+  if (e->frames_failed != 0) {
+    log_error("{} exported frames could not be written to {}", e->frames_failed, e->output);
+  }
+
+  glDeleteBuffers(static_cast<GLsizei>(readback_ring_size), e->pbos.data());
+  glDeleteRenderbuffers(1, &e->depth);
+  glDeleteRenderbuffers(1, &e->color);
+  glDeleteFramebuffers(1, &e->fbo);
+
+  delete e;
+}
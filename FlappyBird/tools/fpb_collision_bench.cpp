@@ -0,0 +1,115 @@
+// Times the bird against pipe collision test with sprite rects only, as it was before pixel masks,
+// against the rect broad phase followed by the mask narrow phase used by the game. It also reports
+// how many rect hits the masks turn down. Run it from the game directory so that the masks are
+// built from the sprites in resources.
+//
+// Usage: fpb-collision-bench [window width] [window height]
+
+#include "flappy_bird.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+// Same test as the broad phase in state_update.cpp
+static inline auto rect_collision(const glm::vec2 &rect1_start, const glm::vec2 &rect1_dims,
+                                  const glm::vec2 &rect2_start,
+                                  const glm::vec2 &rect2_dims) noexcept -> bool {
+  return rect1_start[0] < rect2_start[0] + rect2_dims[0]
+         && rect1_start[0] + rect1_dims[0] > rect2_start[0]
+         && rect1_start[1] < rect2_start[1] + rect2_dims[1]
+         && rect1_start[1] + rect1_dims[1] > rect2_start[1];
+}
+
+template <typename F> static auto ns_per_test(surge::usize tests, F &&f) noexcept -> double {
+  const auto start{std::chrono::steady_clock::now()};
+  f();
+  const auto end{std::chrono::steady_clock::now()};
+
+  return std::chrono::duration<double, std::nano>(end - start).count()
+         / static_cast<double>(tests);
+}
+
+auto main(int argc, char **argv) -> int {
+  using namespace fpb;
+
+  const glm::vec2 window_dims{argc > 2 ? std::strtof(argv[1], nullptr) : 576.0f,  // NOLINT
+                              argc > 2 ? std::strtof(argv[2], nullptr) : 1024.0f}; // NOLINT
+
+  const auto l{entities::make_layout(window_dims)};
+  const auto masks{collision::load_masks()};
+
+  // Bird positions swept over the corner of a lower pipe, where the rects and the masks disagree
+  const glm::vec2 pipe_pos{window_dims[0] / 2.0f, window_dims[1] / 2.0f};
+
+  surge::vector<glm::vec2> positions{};
+  for (auto x = pipe_pos[0] - 1.5f * l.bird_bbox[0]; x < pipe_pos[0] + l.pipe_bbox[0];
+       x += 0.37f) {
+    for (auto y = pipe_pos[1] - 1.5f * l.bird_bbox[1]; y < pipe_pos[1] + l.bird_bbox[1];
+         y += 0.53f) {
+      positions.push_back(glm::vec2{x, y});
+    }
+  }
+
+  surge::vector<glm::vec2> rect_hits{};
+  for (const auto &p : positions) {
+    if (rect_collision(p, l.bird_bbox, pipe_pos, l.pipe_bbox)) {
+      rect_hits.push_back(p);
+    }
+  }
+
+  constexpr surge::usize repetitions{50};
+  surge::usize hits{0};
+
+  const auto rect_ns{ns_per_test(positions.size() * repetitions, [&]() {
+    for (surge::usize r = 0; r < repetitions; r++) {
+      for (const auto &p : positions) {
+        hits += rect_collision(p, l.bird_bbox, pipe_pos, l.pipe_bbox) ? 1 : 0;
+      }
+    }
+  })};
+
+  const auto rect_count{hits / repetitions};
+  hits = 0;
+
+  const auto mask_ns{ns_per_test(positions.size() * repetitions, [&]() {
+    for (surge::usize r = 0; r < repetitions; r++) {
+      const auto &bird_mask{masks.bird_frames[r % masks.bird_frames.size()]}; // NOLINT
+
+      for (const auto &p : positions) {
+        hits += rect_collision(p, l.bird_bbox, pipe_pos, l.pipe_bbox)
+                        && collision::overlap(bird_mask, p, l.bird_bbox, masks.pipe_down,
+                                              pipe_pos, l.pipe_bbox)
+                    ? 1
+                    : 0;
+      }
+    }
+  })};
+
+  const auto mask_count{hits / repetitions};
+  hits = 0;
+
+  const auto narrow_ns{ns_per_test(rect_hits.size() * repetitions, [&]() {
+    for (surge::usize r = 0; r < repetitions; r++) {
+      const auto &bird_mask{masks.bird_frames[r % masks.bird_frames.size()]}; // NOLINT
+
+      for (const auto &p : rect_hits) {
+        hits += collision::overlap(bird_mask, p, l.bird_bbox, masks.pipe_down, pipe_pos,
+                                   l.pipe_bbox)
+                    ? 1
+                    : 0;
+      }
+    }
+  })};
+
+  std::printf("%zu bird positions, %zu rect hits, %zu mask hits (%.1f%% of rect hits rejected)\n",
+              positions.size(), rect_count, mask_count,
+              rect_count == 0 ? 0.0
+                              : 100.0 * static_cast<double>(rect_count - mask_count)
+                                    / static_cast<double>(rect_count));
+  std::printf("rect only:          %.2f ns per test\n", rect_ns);
+  std::printf("rect + mask:        %.2f ns per test\n", mask_ns);
+  std::printf("mask on rect hits:  %.2f ns per test (%zu hits)\n", narrow_ns, hits / repetitions);
+
+  return 0;
+}
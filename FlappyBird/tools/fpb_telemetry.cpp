@@ -0,0 +1,75 @@
+// Prints the telemetry stream of a running game as CSV, one line per tick. When the game exits it
+// waits for the next one and follows it.
+//
+// Usage: fpb-telemetry [shared memory name]
+
+#include "telemetry.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <thread>
+
+static auto wait_for_writer(const char *name) noexcept -> fpb::telemetry::reader {
+  using namespace fpb::telemetry;
+
+  while (true) {
+    if (auto r{open_reader(name)}) {
+      if (writer_alive(*r)) {
+        return *r;
+      }
+
+      close_reader(*r);
+    }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds{100});
+  }
+}
+
+auto main(int argc, char **argv) -> int {
+  using namespace fpb::telemetry;
+
+  const auto name{argc > 1 ? argv[1] : default_name}; // NOLINT
+
+  auto r{wait_for_writer(name)};
+
+  std::printf("tick,state,score,collided,bird_y,bird_vy,dt,update_us,draw_us,pipes\n");
+
+  record rec{};
+  std::uint64_t lost{0};
+  std::uint64_t reported_lost{0};
+
+  while (true) {
+    if (!read(r, rec, lost)) {
+      std::fflush(stdout);
+
+      if (!writer_alive(r)) {
+        close_reader(r);
+        r = wait_for_writer(name);
+        continue;
+      }
+
+      std::this_thread::sleep_for(std::chrono::milliseconds{1});
+      continue;
+    }
+
+    if (lost != reported_lost) {
+      std::fprintf(stderr, "fpb-telemetry: dropped %llu records\n",
+                   static_cast<unsigned long long>(lost - reported_lost));
+      reported_lost = lost;
+    }
+
+    std::printf("%llu,%s,%llu,%u,%.2f,%.2f,%.5f,%.1f,%.1f,",
+                static_cast<unsigned long long>(rec.tick), rec.state_name.data(),
+                static_cast<unsigned long long>(rec.score), rec.collided,
+                static_cast<double>(rec.bird_y), static_cast<double>(rec.bird_vy),
+                static_cast<double>(rec.dt), static_cast<double>(rec.update_us),
+                static_cast<double>(rec.draw_us));
+
+    for (std::uint32_t i = 0; i < rec.pipe_count && i < max_pipes; i++) {
+      std::printf("%s%.1f:%.1f", i == 0 ? "" : " ", static_cast<double>(rec.pipes[2 * i]), // NOLINT
+                  static_cast<double>(rec.pipes[2 * i + 1]));                          // NOLINT
+    }
+
+    std::printf("\n");
+  }
+}